@@ -0,0 +1,674 @@
+#include "devices/ahci.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for SATA disks behind an AHCI host bus adapter, such as
+   QEMU's ich9-ahci, following [AHCI] 1.3 and [SATA] 2.6.
+
+   Each port has a command list of up to 32 slots.  The driver
+   fills a slot with a command FIS and a table of physical
+   regions, then sets the slot's bit in the port's command issue
+   register.  Disks that support native command queueing get READ
+   and WRITE FPDMA QUEUED commands, tagged with their slot, so
+   many can be in flight at once and complete in any order; other
+   disks get one READ or WRITE DMA EXT at a time.  As in the
+   virtio driver, the driver takes dispatches from the block
+   layer's queue, sends them as one or more commands, and
+   completes them from the interrupt handler.
+
+   The driver is used only if the "-ahci" option is given, and
+   only for the first AHCI controller. */
+
+/* PCI class of AHCI controllers and the BAR that holds their
+   registers. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_SATA 0x06
+#define AHCI_ABAR 5
+
+/* Generic host control registers, as offsets from the ABAR. */
+#define HBA_CAP 0x00                    /* Capabilities. */
+#define HBA_GHC 0x04                    /* Global host control. */
+#define HBA_IS 0x08                     /* Interrupt status. */
+#define HBA_PI 0x0c                     /* Ports implemented. */
+#define HBA_PORT(N) (0x100 + (N) * 0x80) /* Registers of port N. */
+#define HBA_SIZE HBA_PORT (32)          /* Size of register area. */
+
+/* HBA_CAP bits. */
+#define CAP_NCS(CAP) ((((CAP) >> 8) & 0x1f) + 1) /* Command slots. */
+#define CAP_SNCQ 0x40000000             /* Supports NCQ. */
+
+/* HBA_GHC bits. */
+#define GHC_IE 0x00000002               /* Interrupt enable. */
+#define GHC_AE 0x80000000               /* AHCI enable. */
+
+/* Port registers, as offsets from HBA_PORT(N). */
+#define PX_CLB 0x00                     /* Command list base. */
+#define PX_CLBU 0x04                    /* Command list base, upper. */
+#define PX_FB 0x08                      /* Received FIS base. */
+#define PX_FBU 0x0c                     /* Received FIS base, upper. */
+#define PX_IS 0x10                      /* Interrupt status. */
+#define PX_IE 0x14                      /* Interrupt enable. */
+#define PX_CMD 0x18                     /* Command and status. */
+#define PX_TFD 0x20                     /* Task file data. */
+#define PX_SIG 0x24                     /* Device signature. */
+#define PX_SSTS 0x28                    /* SATA status. */
+#define PX_SERR 0x30                    /* SATA error. */
+#define PX_SACT 0x34                    /* Outstanding NCQ tags. */
+#define PX_CI 0x38                      /* Command issue. */
+
+/* PX_CMD bits. */
+#define CMD_ST 0x0001                   /* Process command list. */
+#define CMD_SUD 0x0002                  /* Spin up device. */
+#define CMD_POD 0x0004                  /* Power on device. */
+#define CMD_FRE 0x0010                  /* Receive FISes. */
+#define CMD_FR 0x4000                   /* FIS receive running. */
+#define CMD_CR 0x8000                   /* Command list running. */
+
+/* PX_IS and PX_IE bits. */
+#define IS_DHRS 0x00000001              /* Register FIS received. */
+#define IS_SDBS 0x00000008              /* Set Device Bits FIS. */
+#define IS_IFS 0x08000000               /* Interface fatal error. */
+#define IS_HBDS 0x10000000              /* Host bus data error. */
+#define IS_HBFS 0x20000000              /* Host bus fatal error. */
+#define IS_TFES 0x40000000              /* Task file error. */
+#define IS_ERRORS (IS_IFS | IS_HBDS | IS_HBFS | IS_TFES)
+
+/* PX_TFD status bits. */
+#define STA_BSY 0x80                    /* Busy. */
+#define STA_DRQ 0x08                    /* Data request. */
+#define STA_ERR 0x01                    /* Error. */
+
+/* PX_SSTS device detection value for an established link, and
+   PX_SIG value of an ATA disk. */
+#define SSTS_DET_PRESENT 3
+#define SIG_ATA 0x00000101
+
+/* ATA commands. */
+#define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+#define CMD_READ_FPDMA 0x60             /* READ FPDMA QUEUED. */
+#define CMD_WRITE_FPDMA 0x61            /* WRITE FPDMA QUEUED. */
+
+/* Register host-to-device FIS, which carries an ATA command. */
+struct fis_h2d
+  {
+    uint8_t type;               /* FIS_TYPE_H2D. */
+    uint8_t flags;              /* FIS_H2D_COMMAND. */
+    uint8_t command;            /* ATA command. */
+    uint8_t feature_lo;         /* Features, bits 0...7. */
+    uint8_t lba[3];             /* LBA, bits 0...23. */
+    uint8_t device;             /* Device register. */
+    uint8_t lba_hi[3];          /* LBA, bits 24...47. */
+    uint8_t feature_hi;         /* Features, bits 8...15. */
+    uint16_t count;             /* Sector count. */
+    uint8_t icc;
+    uint8_t control;
+    uint32_t reserved;
+  };
+#define FIS_TYPE_H2D 0x27
+#define FIS_H2D_COMMAND 0x80    /* FIS updates the command register. */
+#define DEV_LBA 0x40            /* Device register: LBA addressing. */
+
+/* Entry in a port's command list. */
+struct ahci_cmd_header
+  {
+    uint16_t flags;             /* FIS length in dwords, CMDH_*. */
+    uint16_t prd_cnt;           /* Entries in command table's PRDT. */
+    uint32_t byte_cnt;          /* Bytes transferred (set by HBA). */
+    uint32_t table;             /* Physical address of table. */
+    uint32_t table_hi;
+    uint32_t reserved[4];
+  };
+#define CMDH_WRITE 0x0040       /* Transfer is to the device. */
+
+/* Physical region descriptor: one piece of a command's buffer. */
+struct ahci_prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint32_t addr_hi;
+    uint32_t reserved;
+    uint32_t size;              /* Byte count minus 1. */
+  };
+#define PRD_MAX_SIZE (4 * 1024 * 1024)
+
+/* Physical region descriptors per command table, chosen to make
+   each table exactly 1 kB. */
+#define AHCI_PRD_CNT 56
+
+/* Command table, which must be 128-byte aligned. */
+struct ahci_cmd_table
+  {
+    uint8_t fis[64];            /* Command FIS. */
+    uint8_t atapi[16];          /* ATAPI command. */
+    uint8_t reserved[48];
+    struct ahci_prd prd[AHCI_PRD_CNT];
+  };
+
+/* Most sectors in one command. */
+#define AHCI_MAX_SECTORS 0xffff
+
+/* Most ports supported. */
+#define AHCI_MAX_PORTS 8
+
+/* A dispatch from the block layer: a chain of requests covering
+   consecutive sectors, sent as one or more commands. */
+struct ahci_xfer
+  {
+    struct block_request *requests;     /* Requests, or null if free. */
+    bool write;                 /* Transfer to device? */
+    block_sector_t sector;      /* Next sector to send. */
+    size_t left;                /* Sectors not yet sent. */
+    struct block_cursor cursor; /* Buffer of next sector to send. */
+    int outstanding;            /* Commands issued, not completed. */
+  };
+
+/* A port with a disk attached.
+   Members below BLOCK are accessed only with interrupts off. */
+struct ahci_port
+  {
+    char name[8];               /* Name, e.g. "sda". */
+    volatile uint8_t *regs;     /* Port registers. */
+    int port_no;                /* Port number on the HBA. */
+    bool ncq;                   /* Use native command queueing? */
+    int depth;                  /* Slots in use at once, at most. */
+    struct block *block;        /* Registered block device. */
+
+    struct ahci_cmd_header *cmd_list;   /* Command list. */
+    struct ahci_cmd_table *tables;      /* One table per slot. */
+    size_t table_pages;         /* Number of pages in TABLES. */
+    uint32_t issued;            /* Slots issued, not completed. */
+    struct ahci_xfer *slot_xfer[AHCI_MAX_DEPTH]; /* Dispatch by slot. */
+
+    struct ahci_xfer *xfers;    /* Dispatches. */
+    size_t xfer_cnt;            /* Number of XFERS. */
+    struct ahci_xfer *current;  /* Dispatch partly sent, if any. */
+  };
+
+/* Slots used per port at most, set by ahci_configure().  Zero
+   means the driver is not used. */
+static int max_depth;
+
+static volatile uint8_t *abar;  /* HBA registers. */
+static struct ahci_port ports[AHCI_MAX_PORTS];
+static size_t port_cnt;
+
+static struct block_operations ahci_operations;
+
+static bool port_setup (struct ahci_port *, int slot_cnt);
+static void port_teardown (struct ahci_port *);
+static bool identify (struct ahci_port *, uint32_t hba_cap,
+                      block_sector_t *capacity);
+static void interrupt_handler (void *);
+
+/* Returns the 32-bit register at offset REG from BASE. */
+static inline uint32_t
+reg_read (volatile uint8_t *base, size_t reg)
+{
+  return *(volatile uint32_t *) (base + reg);
+}
+
+/* Sets the 32-bit register at offset REG from BASE to VALUE. */
+static inline void
+reg_write (volatile uint8_t *base, size_t reg, uint32_t value)
+{
+  *(volatile uint32_t *) (base + reg) = value;
+}
+
+/* Waits up to TIMEOUT milliseconds for the bits in MASK of
+   register REG at BASE to equal VALUE.  Returns true if
+   successful, false on timeout. */
+static bool
+wait_reg (volatile uint8_t *base, size_t reg, uint32_t mask,
+          uint32_t value, int timeout)
+{
+  while ((reg_read (base, reg) & mask) != value)
+    {
+      if (timeout-- <= 0)
+        return false;
+      timer_msleep (1);
+    }
+  return true;
+}
+
+/* Enables the AHCI driver, keeping at most DEPTH commands in
+   flight per disk, or AHCI_MAX_DEPTH if DEPTH is 0. */
+void
+ahci_configure (int depth)
+{
+  if (depth == 0)
+    depth = AHCI_MAX_DEPTH;
+  if (depth < 1 || depth > AHCI_MAX_DEPTH)
+    PANIC ("-ahci queue depth must be between 1 and %d", AHCI_MAX_DEPTH);
+  max_depth = depth;
+}
+
+/* If the AHCI driver is enabled, finds the first AHCI
+   controller, then initializes and registers the disks on its
+   ports. */
+void
+ahci_init (void)
+{
+  struct pci_dev pci;
+  uint32_t cap, implemented;
+  int i;
+
+  if (max_depth == 0)
+    return;
+  if (!pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_SATA, &pci))
+    {
+      printf ("ahci: no controller found\n");
+      return;
+    }
+  pci_enable (&pci, PCI_CMD_MEMORY | PCI_CMD_MASTER);
+  abar = pci_map_mmio (pci_bar (&pci, AHCI_ABAR), HBA_SIZE);
+
+  /* Switch to AHCI mode and take interrupts.  Ports stay quiet
+     until each one enables its own. */
+  reg_write (abar, HBA_GHC, reg_read (abar, HBA_GHC) | GHC_AE);
+  reg_write (abar, HBA_IS, reg_read (abar, HBA_IS));
+  pci_register_irq (&pci, interrupt_handler, NULL, "AHCI");
+  reg_write (abar, HBA_GHC, reg_read (abar, HBA_GHC) | GHC_IE);
+
+  cap = reg_read (abar, HBA_CAP);
+  implemented = reg_read (abar, HBA_PI);
+  for (i = 0; i < 32 && port_cnt < AHCI_MAX_PORTS; i++)
+    {
+      struct ahci_port *p = &ports[port_cnt];
+      block_sector_t capacity;
+      char extra_info[32];
+
+      if (!(implemented & (1u << i)))
+        continue;
+      p->regs = abar + HBA_PORT (i);
+      p->port_no = i;
+      if ((reg_read (p->regs, PX_SSTS) & 0xf) != SSTS_DET_PRESENT
+          || reg_read (p->regs, PX_SIG) != SIG_ATA)
+        continue;
+
+      snprintf (p->name, sizeof p->name, "sd%c", 'a' + (int) port_cnt);
+      if (!port_setup (p, CAP_NCS (cap)))
+        {
+          printf ("%s: cannot start port %d, ignoring\n", p->name, i);
+          port_teardown (p);
+          continue;
+        }
+      if (!identify (p, cap, &capacity))
+        {
+          printf ("%s: IDENTIFY DEVICE failed, ignoring\n", p->name);
+          port_teardown (p);
+          continue;
+        }
+      port_cnt++;
+
+      if (p->ncq)
+        snprintf (extra_info, sizeof extra_info, "AHCI, NCQ depth %d",
+                  p->depth);
+      else
+        snprintf (extra_info, sizeof extra_info, "AHCI");
+      p->block = block_register (p->name, BLOCK_RAW, extra_info, capacity,
+                                 &ahci_operations, p);
+      reg_write (p->regs, PX_IS, reg_read (p->regs, PX_IS));
+      reg_write (p->regs, PX_IE, IS_DHRS | IS_SDBS | IS_ERRORS);
+      partition_scan (p->block);
+    }
+}
+
+/* Stops port P, gives it a command list, received FIS area, and
+   command tables for up to SLOT_CNT slots, and starts it again.
+   Returns false if the port does not respond or memory is
+   short, in which case the caller must call port_teardown(). */
+static bool
+port_setup (struct ahci_port *p, int slot_cnt)
+{
+  p->cmd_list = NULL;
+  p->tables = NULL;
+  p->xfers = NULL;
+
+  /* Stop processing commands, then receiving FISes. */
+  reg_write (p->regs, PX_CMD, reg_read (p->regs, PX_CMD) & ~CMD_ST);
+  if (!wait_reg (p->regs, PX_CMD, CMD_CR, 0, 500))
+    return false;
+  reg_write (p->regs, PX_CMD, reg_read (p->regs, PX_CMD) & ~CMD_FRE);
+  if (!wait_reg (p->regs, PX_CMD, CMD_FR, 0, 500))
+    return false;
+
+  /* The 1 kB command list and the 256-byte received FIS area
+     share a page.  Command tables follow in pages of their own.
+     The xfer pool has one dispatch per slot, plus one that may
+     be partly sent. */
+  p->depth = slot_cnt < max_depth ? slot_cnt : max_depth;
+  p->table_pages = DIV_ROUND_UP (p->depth * sizeof (struct ahci_cmd_table),
+                                 PGSIZE);
+  p->cmd_list = palloc_get_page (PAL_ZERO);
+  p->tables = palloc_get_multiple (PAL_ZERO, p->table_pages);
+  p->xfer_cnt = p->depth + 1;
+  p->xfers = calloc (p->xfer_cnt, sizeof *p->xfers);
+  if (p->cmd_list == NULL || p->tables == NULL || p->xfers == NULL)
+    return false;
+  p->issued = 0;
+  p->current = NULL;
+
+  reg_write (p->regs, PX_CLB, vtop (p->cmd_list));
+  reg_write (p->regs, PX_CLBU, 0);
+  reg_write (p->regs, PX_FB, vtop ((uint8_t *) p->cmd_list + 1024));
+  reg_write (p->regs, PX_FBU, 0);
+  reg_write (p->regs, PX_IE, 0);
+  reg_write (p->regs, PX_SERR, reg_read (p->regs, PX_SERR));
+  reg_write (p->regs, PX_IS, reg_read (p->regs, PX_IS));
+
+  reg_write (p->regs, PX_CMD,
+             reg_read (p->regs, PX_CMD) | CMD_SUD | CMD_POD | CMD_FRE);
+  if (!wait_reg (p->regs, PX_TFD, STA_BSY | STA_DRQ, 0, 1000))
+    return false;
+  reg_write (p->regs, PX_CMD, reg_read (p->regs, PX_CMD) | CMD_ST);
+  return true;
+}
+
+/* Stops port P and frees the memory that port_setup() gave it.
+   If the port does not stop, the HBA may still write to that
+   memory, so it is kept. */
+static void
+port_teardown (struct ahci_port *p)
+{
+  reg_write (p->regs, PX_CMD, reg_read (p->regs, PX_CMD) & ~CMD_ST);
+  if (!wait_reg (p->regs, PX_CMD, CMD_CR, 0, 500))
+    return;
+  reg_write (p->regs, PX_CMD, reg_read (p->regs, PX_CMD) & ~CMD_FRE);
+  if (!wait_reg (p->regs, PX_CMD, CMD_FR, 0, 500))
+    return;
+
+  palloc_free_page (p->cmd_list);
+  palloc_free_multiple (p->tables, p->table_pages);
+  free (p->xfers);
+  p->cmd_list = NULL;
+  p->tables = NULL;
+  p->xfers = NULL;
+}
+
+/* Fills in SLOT of port P to send COMMAND with the given
+   FEATURES, LBA, and COUNT, with PRD_CNT physical regions already
+   in the slot's command table. */
+static void
+build_command (struct ahci_port *p, int slot, uint8_t command,
+               uint16_t features, uint64_t lba, uint16_t count,
+               size_t prd_cnt, bool write)
+{
+  struct ahci_cmd_table *t = &p->tables[slot];
+  struct ahci_cmd_header *h = &p->cmd_list[slot];
+  struct fis_h2d *fis = (struct fis_h2d *) t->fis;
+
+  memset (fis, 0, sizeof *fis);
+  fis->type = FIS_TYPE_H2D;
+  fis->flags = FIS_H2D_COMMAND;
+  fis->command = command;
+  fis->feature_lo = features;
+  fis->feature_hi = features >> 8;
+  fis->lba[0] = lba;
+  fis->lba[1] = lba >> 8;
+  fis->lba[2] = lba >> 16;
+  fis->lba_hi[0] = lba >> 24;
+  fis->lba_hi[1] = lba >> 32;
+  fis->lba_hi[2] = lba >> 40;
+  fis->device = DEV_LBA;
+  fis->count = count;
+
+  h->flags = sizeof *fis / 4 | (write ? CMDH_WRITE : 0);
+  h->prd_cnt = prd_cnt;
+  h->byte_cnt = 0;
+  h->table = vtop (t);
+  h->table_hi = 0;
+}
+
+/* Reads port P's IDENTIFY DEVICE data by polling, with the
+   port's interrupts still disabled, and sets *CAPACITY, P->ncq,
+   and P->depth from it.  HBA_CAP is the HBA's capabilities.
+   Returns false if the command fails. */
+static bool
+identify (struct ahci_port *p, uint32_t hba_cap, block_sector_t *capacity)
+{
+  struct ahci_prd *prd = &p->tables[0].prd[0];
+  uint16_t *id = palloc_get_page (0);
+  uint64_t sectors;
+  bool ok;
+
+  if (id == NULL)
+    return false;
+  prd->addr = vtop (id);
+  prd->addr_hi = 0;
+  prd->size = BLOCK_SECTOR_SIZE - 1;
+  build_command (p, 0, CMD_IDENTIFY_DEVICE, 0, 0, 0, 1, false);
+  barrier ();
+  reg_write (p->regs, PX_CI, 1);
+  ok = (wait_reg (p->regs, PX_CI, 1, 0, 1000)
+        && !(reg_read (p->regs, PX_TFD) & STA_ERR));
+  reg_write (p->regs, PX_IS, reg_read (p->regs, PX_IS));
+
+  if (ok)
+    {
+      /* Words 100...103 hold the 48-bit capacity if the disk
+         supports it (word 83 bit 10), otherwise words 60...61
+         hold the 28-bit capacity. */
+      if (id[83] & (1 << 10))
+        sectors = (id[100] | (uint64_t) id[101] << 16
+                   | (uint64_t) id[102] << 32 | (uint64_t) id[103] << 48);
+      else
+        sectors = id[60] | (uint32_t) id[61] << 16;
+      if (sectors > (block_sector_t) -1)
+        {
+          printf ("%s: using only the first %'"PRDSNu" sectors\n",
+                  p->name, (block_sector_t) -1);
+          sectors = (block_sector_t) -1;
+        }
+      *capacity = sectors;
+
+      /* Word 76 bit 8 says the disk supports NCQ, and word 75
+         gives its queue depth minus 1.  Without NCQ the disk takes
+         one command at a time. */
+      p->ncq = (hba_cap & CAP_SNCQ) && (id[76] & (1 << 8));
+      if (!p->ncq)
+        p->depth = 1;
+      else if ((id[75] & 0x1f) + 1 < p->depth)
+        p->depth = (id[75] & 0x1f) + 1;
+    }
+  palloc_free_page (id);
+  return ok;
+}
+
+/* Fills a free slot of port P with a command for the next
+   sectors of dispatch X, as many as fit in AHCI_PRD_CNT pieces of
+   memory, and issues it.  Returns false, issuing nothing, if no
+   slot is free. */
+static bool
+issue_command (struct ahci_port *p, struct ahci_xfer *x)
+{
+  struct ahci_cmd_table *t;
+  size_t prd_cnt = 0;
+  size_t cnt = 0;
+  int slot;
+
+  for (slot = 0; slot < p->depth; slot++)
+    if (!(p->issued & (1u << slot)))
+      break;
+  if (slot >= p->depth)
+    return false;
+  t = &p->tables[slot];
+
+  /* Extend the last region when the next sector follows it in
+     physical memory. */
+  while (x->left > cnt && cnt < AHCI_MAX_SECTORS)
+    {
+      struct block_cursor save = x->cursor;
+      uintptr_t addr = vtop (block_cursor_next (&x->cursor));
+      struct ahci_prd *prev = prd_cnt > 0 ? &t->prd[prd_cnt - 1] : NULL;
+
+      if (prev != NULL && prev->addr + prev->size + 1 == addr
+          && prev->size + 1 + BLOCK_SECTOR_SIZE <= PRD_MAX_SIZE)
+        prev->size += BLOCK_SECTOR_SIZE;
+      else if (prd_cnt < AHCI_PRD_CNT)
+        {
+          struct ahci_prd *prd = &t->prd[prd_cnt++];
+          prd->addr = addr;
+          prd->addr_hi = 0;
+          prd->reserved = 0;
+          prd->size = BLOCK_SECTOR_SIZE - 1;
+        }
+      else
+        {
+          x->cursor = save;
+          break;
+        }
+      cnt++;
+    }
+
+  /* A queued command carries its count in the features register
+     and its tag, which is its slot, in the count register. */
+  if (p->ncq)
+    build_command (p, slot, x->write ? CMD_WRITE_FPDMA : CMD_READ_FPDMA,
+                   cnt, x->sector, slot << 3, prd_cnt, x->write);
+  else
+    build_command (p, slot, x->write ? CMD_WRITE_DMA_EXT : CMD_READ_DMA_EXT,
+                   0, x->sector, cnt, prd_cnt, x->write);
+  p->slot_xfer[slot] = x;
+  x->sector += cnt;
+  x->left -= cnt;
+  x->outstanding++;
+
+  /* The HBA must see the command before it is issued, and a
+     queued command's tag must be active before it is issued. */
+  barrier ();
+  if (p->ncq)
+    reg_write (p->regs, PX_SACT, 1u << slot);
+  reg_write (p->regs, PX_CI, 1u << slot);
+  p->issued |= 1u << slot;
+  return true;
+}
+
+/* Returns a free dispatch of P, or a null pointer if all are in
+   use. */
+static struct ahci_xfer *
+find_free_xfer (struct ahci_port *p)
+{
+  size_t i;
+
+  for (i = 0; i < p->xfer_cnt; i++)
+    if (p->xfers[i].requests == NULL)
+      return &p->xfers[i];
+  return NULL;
+}
+
+/* Issues as many of port P's queued requests as it has free
+   slots for.  Called by the block layer with interrupts off, and
+   by the interrupt handler once commands complete. */
+static void
+ahci_start (void *p_)
+{
+  struct ahci_port *p = p_;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (;;)
+    {
+      struct ahci_xfer *x = p->current;
+
+      if (x == NULL)
+        {
+          struct block_request *r;
+
+          x = find_free_xfer (p);
+          if (x == NULL || (r = block_dequeue (p->block)) == NULL)
+            break;
+          x->requests = r;
+          x->write = r->write;
+          x->sector = r->sector;
+          for (x->left = 0; r != NULL; r = r->next)
+            x->left += r->cnt;
+          block_cursor_init (&x->cursor, x->requests);
+          x->outstanding = 0;
+          p->current = x;
+        }
+
+      if (!issue_command (p, x))
+        break;
+      if (x->left == 0)
+        p->current = NULL;
+    }
+}
+
+static struct block_operations ahci_operations =
+  {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ahci_start,
+    NULL
+  };
+
+/* Handles an interrupt from port P: completes the dispatches
+   whose commands are all done and issues more. */
+static void
+handle_port (struct ahci_port *p)
+{
+  uint32_t is = reg_read (p->regs, PX_IS);
+  uint32_t done;
+  int slot;
+
+  reg_write (p->regs, PX_IS, is);
+  if (is & IS_ERRORS)
+    PANIC ("%s: disk error, PxIS=%08"PRIx32", PxTFD=%08"PRIx32
+           ", PxSACT=%08"PRIx32", PxCI=%08"PRIx32,
+           p->name, is, reg_read (p->regs, PX_TFD),
+           reg_read (p->regs, PX_SACT), reg_read (p->regs, PX_CI));
+
+  /* A command is done once the HBA has cleared its bit in the
+     command issue register and, if queued, the disk has cleared
+     its tag. */
+  done = p->issued & ~(reg_read (p->regs, PX_SACT)
+                       | reg_read (p->regs, PX_CI));
+  p->issued &= ~done;
+  for (slot = 0; slot < p->depth; slot++)
+    if (done & (1u << slot))
+      {
+        struct ahci_xfer *x = p->slot_xfer[slot];
+
+        p->slot_xfer[slot] = NULL;
+        if (--x->outstanding == 0 && x->left == 0)
+          {
+            struct block_request *requests = x->requests;
+            x->requests = NULL;
+            block_complete (p->block, requests);
+          }
+      }
+  ahci_start (p);
+}
+
+/* AHCI interrupt handler. */
+static void
+interrupt_handler (void *aux UNUSED)
+{
+  uint32_t is = reg_read (abar, HBA_IS);
+  size_t i;
+
+  /* The line may be shared with another device. */
+  if (is == 0)
+    return;
+
+  /* Port interrupts must be cleared before the HBA's. */
+  for (i = 0; i < port_cnt; i++)
+    if (is & (1u << ports[i].port_no))
+      handle_port (&ports[i]);
+  reg_write (abar, HBA_IS, is);
+}
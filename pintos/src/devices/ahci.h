@@ -0,0 +1,10 @@
+#ifndef DEVICES_AHCI_H
+#define DEVICES_AHCI_H
+
+/* Most commands an AHCI port can have in flight. */
+#define AHCI_MAX_DEPTH 32
+
+void ahci_configure (int depth);
+void ahci_init (void);
+
+#endif /* devices/ahci.h */
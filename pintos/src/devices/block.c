@@ -3,7 +3,12 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Most sectors that block_dequeue() merges into one dispatch. */
+#define BLOCK_MERGE_MAX 256
 
 /* A block device. */
 struct block
@@ -17,8 +22,15 @@ struct block
     const struct block_operations *ops;  /* Driver operations. */
     void *aux;                          /* Extra data owned by driver. */
 
-    unsigned long long read_cnt;        /* Number of sectors read. */
-    unsigned long long write_cnt;       /* Number of sectors written. */
+    /* Request queue, for drivers with a START operation.
+       Accessed only with interrupts off. */
+    struct list queue;                  /* Pending requests by sector. */
+    block_sector_t head;                /* Sector after last dispatch. */
+
+    /* Statistics.  Accessed only with interrupts off. */
+    struct block_stats stats;
+    unsigned depth;                     /* Requests submitted, not done. */
+    block_sector_t last_end;            /* Sector after last submission. */
   };
 
 /* List of all block devices. */
@@ -29,6 +41,15 @@ static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
 
+/* Returns the CPU's time-stamp counter. */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Returns a human-readable name for the given block device
    TYPE. */
 const char *
@@ -113,6 +134,221 @@ check_sector (struct block *block, block_sector_t sector)
     }
 }
 
+/* Returns true if request A starts at a lower sector than
+   request B. */
+static bool
+request_less (const struct list_elem *a_, const struct list_elem *b_,
+              void *aux UNUSED)
+{
+  const struct block_request *a = list_entry (a_, struct block_request, elem);
+  const struct block_request *b = list_entry (b_, struct block_request, elem);
+
+  return a->sector < b->sector;
+}
+
+/* Verifies that the sectors described by the IOV_CNT buffers in
+   IOV, starting at SECTOR, lie within BLOCK, and returns how many
+   there are.  Panics if not. */
+static block_sector_t
+check_run (struct block *block, block_sector_t sector,
+           const struct block_iovec *iov, size_t iov_cnt)
+{
+  block_sector_t cnt = 0;
+  size_t i;
+
+  for (i = 0; i < iov_cnt; i++)
+    cnt += iov[i].cnt;
+  if (cnt > 0)
+    {
+      check_sector (block, sector);
+      if (cnt > block->size - sector)
+        check_sector (block, block->size);
+    }
+  return cnt;
+}
+
+/* Initializes R to transfer the consecutive sectors starting at
+   SECTOR to or from the IOV_CNT buffers in IOV, writing if WRITE
+   is true, and then to call COMPLETE with R and AUX. */
+void
+block_request_init (struct block_request *r, block_sector_t sector,
+                    bool write, const struct block_iovec *iov,
+                    size_t iov_cnt, block_complete_func *complete,
+                    void *aux)
+{
+  r->sector = sector;
+  r->write = write;
+  r->iov = iov;
+  r->iov_cnt = iov_cnt;
+  r->complete = complete;
+  r->aux = aux;
+  r->origin = NULL;
+}
+
+/* Records the submission of request R to BLOCK.  Must be called
+   with interrupts off. */
+static void
+count_submit (struct block *block, const struct block_request *r)
+{
+  struct block_stats *s = &block->stats;
+
+  if (r->write)
+    s->write_cnt += r->cnt;
+  else
+    s->read_cnt += r->cnt;
+  if (r->sector == block->last_end)
+    s->seq_cnt++;
+  else
+    s->random_cnt++;
+  block->last_end = r->sector + r->cnt;
+
+  block->depth++;
+  s->depth_sum += block->depth;
+  if (block->depth > s->depth_max)
+    s->depth_max = block->depth;
+}
+
+/* Returns the histogram bucket for a time of CYCLES. */
+static int
+hist_bucket (uint64_t cycles)
+{
+  int bucket = 0;
+
+  while (cycles > 1 && bucket < BLOCK_HIST_BUCKETS - 1)
+    {
+      cycles >>= 1;
+      bucket++;
+    }
+  return bucket;
+}
+
+/* Records the completion, at cycle count NOW, of request R
+   submitted to BLOCK.  Must be called with interrupts off. */
+static void
+count_complete (struct block *block, const struct block_request *r,
+                uint64_t now)
+{
+  struct block_stats *s = &block->stats;
+
+  s->done_cnt++;
+  s->queue_hist[hist_bucket (r->dispatch_time - r->submit_time)]++;
+  s->service_hist[hist_bucket (now - r->dispatch_time)]++;
+  block->depth--;
+}
+
+/* Records the completion of request R, dispatched to BLOCK, and
+   calls its completion function.  Must be called with interrupts
+   off. */
+static void
+finish_request (struct block *block, struct block_request *r)
+{
+  uint64_t now = rdtsc ();
+
+  count_complete (block, r, now);
+  if (r->origin != block)
+    count_complete (r->origin, r, now);
+  r->complete (r, r->aux);
+}
+
+/* Carries out request R on BLOCK, whose driver has neither a
+   request queue nor a SUBMIT operation, by calling the driver's
+   synchronous operations. */
+static void
+driver_transfer (struct block *block, struct block_request *r)
+{
+  const struct block_operations *ops = block->ops;
+  block_sector_t sector = r->sector;
+  size_t i, j;
+
+  if (r->write && ops->write_multi != NULL)
+    ops->write_multi (block->aux, sector, r->iov, r->iov_cnt);
+  else if (!r->write && ops->read_multi != NULL)
+    ops->read_multi (block->aux, sector, r->iov, r->iov_cnt);
+  else
+    for (i = 0; i < r->iov_cnt; i++)
+      for (j = 0; j < r->iov[i].cnt; j++)
+        {
+          uint8_t *buffer = ((uint8_t *) r->iov[i].base
+                             + j * BLOCK_SECTOR_SIZE);
+          if (r->write)
+            ops->write (block->aux, sector++, buffer);
+          else
+            ops->read (block->aux, sector++, buffer);
+        }
+}
+
+/* Starts request R, initialized with block_request_init(), on
+   BLOCK and returns, usually before the transfer is done.
+   Requests to a device with a request queue wait there, in
+   elevator order, and may be merged with their neighbors; the
+   caller may submit many before waiting for any.  For a device
+   without one, the transfer happens, and R completes, before
+   block_submit() returns. */
+void
+block_submit (struct block *block, struct block_request *r)
+{
+  const struct block_operations *ops = block->ops;
+  enum intr_level old_level;
+
+  ASSERT (!r->write || block->type != BLOCK_FOREIGN);
+
+  r->cnt = check_run (block, r->sector, r->iov, r->iov_cnt);
+  if (r->cnt == 0)
+    {
+      r->complete (r, r->aux);
+      return;
+    }
+
+  old_level = intr_disable ();
+  count_submit (block, r);
+  if (r->origin == NULL)
+    {
+      r->origin = block;
+      r->submit_time = rdtsc ();
+    }
+  if (ops->start != NULL)
+    {
+      list_insert_ordered (&block->queue, &r->elem, request_less, NULL);
+      ops->start (block->aux);
+    }
+  intr_set_level (old_level);
+
+  if (ops->submit != NULL)
+    ops->submit (block->aux, r);
+  else if (ops->start == NULL)
+    {
+      r->dispatch_time = rdtsc ();
+      driver_transfer (block, r);
+
+      old_level = intr_disable ();
+      finish_request (block, r);
+      intr_set_level (old_level);
+    }
+}
+
+/* Completion function for transfer(): wakes up the waiter. */
+static void
+wake_waiter (struct block_request *r UNUSED, void *done)
+{
+  sema_up (done);
+}
+
+/* Transfers the consecutive sectors of BLOCK starting at SECTOR
+   to or from the IOV_CNT buffers in IOV, writing if WRITE is
+   true, and returns when the transfer is done. */
+static void
+transfer (struct block *block, block_sector_t sector,
+          const struct block_iovec *iov, size_t iov_cnt, bool write)
+{
+  struct block_request r;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  block_request_init (&r, sector, write, iov, iov_cnt, wake_waiter, &done);
+  block_submit (block, &r);
+  sema_down (&done);
+}
+
 /* Reads sector SECTOR from BLOCK into BUFFER, which must
    have room for BLOCK_SECTOR_SIZE bytes.
    Internally synchronizes accesses to block devices, so external
@@ -120,9 +356,8 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  struct block_iovec iov = { buffer, 1 };
+  transfer (block, sector, &iov, 1, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +368,32 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  struct block_iovec iov = { (void *) buffer, 1 };
+  transfer (block, sector, &iov, 1, true);
+}
+
+/* Reads consecutive sectors of BLOCK, starting at SECTOR, into
+   the IOV_CNT buffers in IOV, filling each in turn.  The whole
+   run is a single request to the device, or a single call to the
+   driver's multi-sector operation, if the driver supports one.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multi (struct block *block, block_sector_t sector,
+                  const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (block, sector, iov, iov_cnt, false);
+}
+
+/* Writes consecutive sectors of BLOCK, starting at SECTOR, from
+   the IOV_CNT buffers in IOV, taking each in turn.  Returns
+   after the block device has acknowledged receiving the data.
+   Otherwise like block_read_multi(). */
+void
+block_write_multi (struct block *block, block_sector_t sector,
+                   const struct block_iovec *iov, size_t iov_cnt)
+{
+  transfer (block, sector, iov, iov_cnt, true);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -160,7 +417,34 @@ block_type (struct block *block)
   return block->type;
 }
 
-/* Prints statistics for each block device used for a Pintos role. */
+/* Copies BLOCK's statistics into *STATS.  May be called at any
+   time. */
+void
+block_get_stats (struct block *block, struct block_stats *stats)
+{
+  enum intr_level old_level = intr_disable ();
+  *stats = block->stats;
+  intr_set_level (old_level);
+}
+
+/* Prints the nonempty buckets of histogram HIST, labeled NAME, as
+   "log2(cycles):count" pairs. */
+static void
+print_histogram (const char *name, const unsigned long long *hist)
+{
+  int i;
+
+  printf ("  %s:", name);
+  for (i = 0; i < BLOCK_HIST_BUCKETS; i++)
+    if (hist[i] != 0)
+      printf (" %d:%llu", i, hist[i]);
+  printf ("\n");
+}
+
+/* Prints statistics for each block device used for a Pintos
+   role: sectors transferred, access pattern, queue depth, and
+   histograms of queueing and service times.  May be called at
+   any time. */
 void
 block_print_stats (void)
 {
@@ -169,12 +453,27 @@ block_print_stats (void)
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
       struct block *block = block_by_role[i];
-      if (block != NULL)
-        {
-          printf ("%s (%s): %llu reads, %llu writes\n",
-                  block->name, block_type_name (block->type),
-                  block->read_cnt, block->write_cnt);
-        }
+      struct block_stats s;
+      unsigned long long req_cnt, depth10;
+
+      if (block == NULL)
+        continue;
+
+      block_get_stats (block, &s);
+      printf ("%s (%s): %llu reads, %llu writes\n",
+              block->name, block_type_name (block->type),
+              s.read_cnt, s.write_cnt);
+
+      req_cnt = s.seq_cnt + s.random_cnt;
+      if (req_cnt == 0)
+        continue;
+      depth10 = s.depth_sum * 10 / req_cnt;
+      printf ("  %llu requests (%llu sequential, %llu random), "
+              "queue depth max %u, avg %llu.%llu\n",
+              req_cnt, s.seq_cnt, s.random_cnt,
+              s.depth_max, depth10 / 10, depth10 % 10);
+      print_histogram ("queue time, log2 cycles", s.queue_hist);
+      print_histogram ("service time, log2 cycles", s.service_hist);
     }
 }
 
@@ -198,8 +497,11 @@ block_register (const char *name, enum block_type type,
   block->size = size;
   block->ops = ops;
   block->aux = aux;
-  block->read_cnt = 0;
-  block->write_cnt = 0;
+  list_init (&block->queue);
+  block->head = 0;
+  memset (&block->stats, 0, sizeof block->stats);
+  block->depth = 0;
+  block->last_end = 0;
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -211,6 +513,130 @@ block_register (const char *name, enum block_type type,
   return block;
 }
 
+/* Returns true if request B can be transferred right after
+   request A in a single dispatch that already has TOTAL
+   sectors. */
+static bool
+mergeable (const struct block_request *a, const struct block_request *b,
+           block_sector_t total)
+{
+  return (a->sector + a->cnt == b->sector && a->write == b->write
+          && total + b->cnt <= BLOCK_MERGE_MAX);
+}
+
+/* Removes the next requests to dispatch from BLOCK's queue and
+   returns the first of them, or a null pointer if the queue is
+   empty.  The requests are chained through their NEXT members
+   and cover consecutive sectors in a single direction, so that
+   the driver can transfer them as one run.
+
+   Requests are served in C-LOOK order: ascending by sector from
+   where the last dispatch ended, then back to the lowest pending
+   sector.  Requests adjacent to the chosen one, on either side,
+   are merged into the dispatch, up to BLOCK_MERGE_MAX sectors.
+   Must be called with interrupts off. */
+struct block_request *
+block_dequeue (struct block *block)
+{
+  struct list *q = &block->queue;
+  struct block_request *first, *last, *r;
+  struct list_elem *e;
+  block_sector_t total;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (list_empty (q))
+    return NULL;
+
+  /* Next request at or after the head, wrapping around. */
+  for (e = list_begin (q); e != list_end (q); e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head)
+      break;
+  if (e == list_end (q))
+    e = list_begin (q);
+  first = last = list_entry (e, struct block_request, elem);
+  total = first->cnt;
+
+  /* Merge requests that end where it starts... */
+  while (list_prev (&first->elem) != list_head (q))
+    {
+      r = list_entry (list_prev (&first->elem), struct block_request, elem);
+      if (!mergeable (r, first, total))
+        break;
+      total += r->cnt;
+      first = r;
+    }
+
+  /* ...and requests that start where it ends. */
+  while (list_next (&last->elem) != list_end (q))
+    {
+      r = list_entry (list_next (&last->elem), struct block_request, elem);
+      if (!mergeable (last, r, total))
+        break;
+      total += r->cnt;
+      last = r;
+    }
+
+  /* Unlink and chain them. */
+  for (r = first; r != last; r = r->next)
+    r->next = list_entry (list_remove (&r->elem), struct block_request, elem);
+  list_remove (&last->elem);
+  last->next = NULL;
+  for (r = first; r != NULL; r = r->next)
+    r->dispatch_time = rdtsc ();
+
+  block->head = last->sector + last->cnt;
+  return first;
+}
+
+/* Calls the completion functions of REQUESTS, a chain returned
+   by block_dequeue() for BLOCK, whose transfer has finished.
+   Must be called with interrupts off, as from an interrupt
+   handler. */
+void
+block_complete (struct block *block, struct block_request *requests)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (requests != NULL)
+    {
+      struct block_request *r = requests;
+      requests = r->next;
+      finish_request (block, r);
+    }
+}
+
+/* Initializes cursor C to the first sector of REQUESTS, a chain
+   returned by block_dequeue(). */
+void
+block_cursor_init (struct block_cursor *c, struct block_request *requests)
+{
+  c->req = requests;
+  c->iov = requests->iov;
+  c->ofs = 0;
+}
+
+/* Returns the buffer for the next sector at cursor C and
+   advances C past it.  C must not be at the end of its chain. */
+void *
+block_cursor_next (struct block_cursor *c)
+{
+  uint8_t *sector;
+
+  while (c->ofs >= c->iov->cnt)
+    {
+      if (++c->iov == c->req->iov + c->req->iov_cnt)
+        {
+          c->req = c->req->next;
+          c->iov = c->req->iov;
+        }
+      c->ofs = 0;
+    }
+  sector = (uint8_t *) c->iov->base + c->ofs * BLOCK_SECTOR_SIZE;
+  c->ofs++;
+  return sector;
+}
+
 /* Returns the block device corresponding to LIST_ELEM, or a null
    pointer if LIST_ELEM is the list end of all_blocks. */
 static struct block *
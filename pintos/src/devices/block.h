@@ -3,6 +3,7 @@
 
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -49,26 +50,132 @@ struct block *block_get_by_name (const char *name);
 struct block *block_first (void);
 struct block *block_next (struct block *);
 
+/* One buffer of a scatter-gather transfer: CNT sectors at BASE,
+   which must be a kernel virtual address. */
+struct block_iovec
+  {
+    void *base;                 /* Start of buffer. */
+    size_t cnt;                 /* Number of sectors. */
+  };
+
+/* An asynchronous transfer: the consecutive sectors starting at
+   SECTOR, to or from the buffers in IOV.  Once block_submit()
+   accepts it, the request belongs to the block layer until its
+   COMPLETE function is called, which may happen from an
+   interrupt handler, so COMPLETE must not sleep.  The request
+   and its buffers must stay in place until then. */
+struct block_request;
+typedef void block_complete_func (struct block_request *, void *aux);
+struct block_request
+  {
+    /* Set by the submitter with block_request_init().
+       SECTOR is adjusted as the request passes to the device
+       that contains a partition. */
+    block_sector_t sector;              /* First sector. */
+    bool write;                         /* Write to device? */
+    const struct block_iovec *iov;      /* Buffers. */
+    size_t iov_cnt;                     /* Number of buffers. */
+    block_complete_func *complete;      /* Called on completion. */
+    void *aux;                          /* Passed to COMPLETE. */
+
+    /* Owned by the block layer. */
+    block_sector_t cnt;                 /* Number of sectors. */
+    struct list_elem elem;              /* Element in device's queue. */
+    struct block_request *next;         /* Next request in a dispatch. */
+    struct block *origin;               /* Device first submitted to. */
+    uint64_t submit_time;               /* Cycle count at submission. */
+    uint64_t dispatch_time;             /* Cycle count at dispatch. */
+  };
+
+void block_request_init (struct block_request *, block_sector_t, bool write,
+                         const struct block_iovec *, size_t iov_cnt,
+                         block_complete_func *, void *aux);
+void block_submit (struct block *, struct block_request *);
+
 /* Block device operations. */
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multi (struct block *, block_sector_t,
+                       const struct block_iovec *, size_t iov_cnt);
+void block_write_multi (struct block *, block_sector_t,
+                        const struct block_iovec *, size_t iov_cnt);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
 /* Statistics. */
+
+/* Number of buckets in a latency histogram.  Bucket 0 counts
+   times of 0 or 1 CPU cycles, bucket I counts times from 2**I to
+   2**(I+1) - 1 cycles, and the last bucket also counts anything
+   longer. */
+#define BLOCK_HIST_BUCKETS 32
+
+/* Statistics for a block device.  Requests to a partition count
+   both for the partition and for the device that contains it. */
+struct block_stats
+  {
+    unsigned long long read_cnt;        /* Number of sectors read. */
+    unsigned long long write_cnt;       /* Number of sectors written. */
+    unsigned long long seq_cnt;         /* Requests that started where
+                                           the previous one ended. */
+    unsigned long long random_cnt;      /* Other requests. */
+    unsigned long long done_cnt;        /* Requests completed. */
+    unsigned long long depth_sum;       /* Sum of queue depths. */
+    unsigned depth_max;                 /* Maximum queue depth. */
+
+    /* Cycles from submission to dispatch to the device, and from
+       dispatch to completion. */
+    unsigned long long queue_hist[BLOCK_HIST_BUCKETS];
+    unsigned long long service_hist[BLOCK_HIST_BUCKETS];
+  };
+
+void block_get_stats (struct block *, struct block_stats *);
 void block_print_stats (void);
 
 /* Lower-level interface to block device drivers. */
 
+/* READ_MULTI and WRITE_MULTI transfer a run of consecutive
+   sectors to or from a list of buffers.  A driver that cannot do
+   better than one sector at a time may leave them null.
+
+   A driver that queues requests provides START instead of the
+   others.  The block layer calls it, with interrupts off, after
+   queuing a request; if the device is idle, the driver takes the
+   next requests with block_dequeue() and starts them.  It calls
+   block_complete() when they finish, normally from its interrupt
+   handler, and then dequeues again.
+
+   A driver that passes requests on to another device, as
+   partitions do, provides SUBMIT instead. */
 struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+    void (*read_multi) (void *aux, block_sector_t,
+                        const struct block_iovec *, size_t iov_cnt);
+    void (*write_multi) (void *aux, block_sector_t,
+                         const struct block_iovec *, size_t iov_cnt);
+    void (*start) (void *aux);
+    void (*submit) (void *aux, struct block_request *);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+struct block_request *block_dequeue (struct block *);
+void block_complete (struct block *, struct block_request *);
+
+/* A position within the sectors of a chain of requests returned
+   by block_dequeue(). */
+struct block_cursor
+  {
+    struct block_request *req;          /* Current request. */
+    const struct block_iovec *iov;      /* Current buffer of REQ. */
+    size_t ofs;                         /* Sectors used of current buffer. */
+  };
+
+void block_cursor_init (struct block_cursor *, struct block_request *);
+void *block_cursor_next (struct block_cursor *);
 
 #endif /* devices/block.h */
@@ -5,13 +5,29 @@
 #include <stdio.h>
 #include "devices/block.h"
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Reads and writes go through the block layer's request queue.
+   The driver starts a transfer when a channel is idle and
+   carries it on from the channel's interrupt handler, which also
+   starts the next queued transfer when one finishes, so callers
+   sleep until their request completes.
+
+   Disks on a channel of a PCI IDE controller with bus mastering,
+   such as the PIIX that QEMU emulates, transfer data by DMA: the
+   driver describes the buffers in a physical region descriptor
+   (PRD) table and the controller moves the data by itself.
+   Other disks, and any disk whose DMA transfer fails, use
+   programmed I/O, with the handler moving each block of data. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +50,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -49,6 +66,50 @@
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+#define CMD_READ_SECTOR_EXT 0x24        /* READ SECTOR(S) EXT. */
+#define CMD_WRITE_SECTOR_EXT 0x34       /* WRITE SECTOR(S) EXT. */
+#define CMD_READ_MULTIPLE_EXT 0x29      /* READ MULTIPLE EXT. */
+#define CMD_WRITE_MULTIPLE_EXT 0x39     /* WRITE MULTIPLE EXT. */
+#define CMD_READ_DMA_EXT 0x25           /* READ DMA EXT. */
+#define CMD_WRITE_DMA_EXT 0x35          /* WRITE DMA EXT. */
+
+/* Bus master IDE registers, as offsets from a channel's
+   BM_BASE. */
+#define BM_COMMAND 0                    /* Command. */
+#define BM_STATUS 2                     /* Status. */
+#define BM_PRDT 4                       /* PRD table physical address. */
+
+/* Bus master command and status bits. */
+#define BM_CMD_START 0x01               /* Start transfer. */
+#define BM_CMD_READ 0x08                /* Transfer from disk to memory. */
+#define BM_STA_ERROR 0x02               /* Transfer failed. */
+#define BM_STA_INTR 0x04                /* Disk raised its interrupt. */
+
+/* PCI class and subclass of IDE controllers, and programming
+   interface bits. */
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+#define PCI_IDE_NATIVE(CHAN_NO) (1 << (2 * (CHAN_NO)))
+#define PCI_IDE_BUS_MASTER 0x80
+
+/* Physical region descriptor: one physically contiguous buffer
+   of a DMA transfer.  It must not cross a 64 kB boundary. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes, 0 meaning 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last descriptor. */
+  };
+#define PRD_EOT 0x8000
+#define PRD_MAX (PGSIZE / sizeof (struct prd))
+
+/* Most sectors one command can transfer. */
+#define MAX_XFER_SECTORS 256
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +118,11 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    bool lba48;                 /* Supports 48-bit LBA? */
+    int multiple;               /* Sectors per interrupt with READ/WRITE
+                                   MULTIPLE, or 0 if not supported. */
+    bool dma;                   /* Transfer data by DMA? */
+    struct block *block;        /* Registered block device, if any. */
   };
 
 /* An ATA channel (aka controller).
@@ -67,11 +133,27 @@ struct channel
     uint16_t reg_base;          /* Base I/O port. */
     uint8_t irq;                /* Interrupt in use. */
 
-    struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master I/O base, 0 if none. */
+    struct prd *prdt;           /* PRD table, one page, if BM_BASE. */
+
+    /* Queued transfer in progress, carried on by the interrupt
+       handler.  Accessed only with interrupts off. */
+    struct ata_disk *active;    /* Disk transferring, or null if idle. */
+    struct block_request *requests;     /* Requests being transferred. */
+    bool write;                 /* Transfer to disk? */
+    block_sector_t sec_no;      /* First sector of current command. */
+    size_t left;                /* Sectors left, counting current command. */
+    size_t cmd_cnt;             /* Sectors in current command. */
+    size_t cmd_left;            /* Sectors of current command left to PIO. */
+    bool cmd_dma;               /* Current command uses DMA? */
+    struct block_cursor cursor; /* Buffer for next sector. */
+    struct block_cursor cmd_start;      /* Buffer for command's first sector. */
+    int next_dev;               /* Device to serve first next time. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -81,28 +163,61 @@ static struct channel channels[CHANNEL_CNT];
 
 static struct block_operations ide_operations;
 
+/* Register IDE disks of 1 GB and larger? */
+static bool allow_large_disks;
+
 static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
-static void issue_pio_command (struct channel *, uint8_t command);
+static void set_multiple_mode (struct ata_disk *, const uint16_t *id);
+
+static void channel_start (struct channel *);
+static void command_start (struct channel *);
+static void pio_start (struct channel *);
+static void pio_input_block (struct channel *);
+static void pio_output_block (struct channel *);
+static void dma_start (struct channel *);
+static bool dma_finish (struct channel *);
+static void transfer_interrupt (struct channel *);
+
+static bool select_sector (struct ata_disk *, block_sector_t, size_t cnt);
+static void issue_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool wait_for_data (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
 
+/* Makes ide_init() register disks of 1 GB and larger, which it
+   otherwise ignores. */
+void
+ide_allow_large_disks (void)
+{
+  allow_large_disks = true;
+}
+
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  struct pci_dev pci;
+  uint16_t bm_base = 0;
   size_t chan_no;
 
+  /* Look for a bus master IDE controller. */
+  if (pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)
+      && (pci.prog_if & PCI_IDE_BUS_MASTER))
+    {
+      bm_base = pci_bar (&pci, 4);
+      pci_enable (&pci, PCI_CMD_IO | PCI_CMD_MASTER);
+    }
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,9 +238,21 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->active = NULL;
+      c->next_dev = 0;
+
+      /* Use the controller's DMA engine if the channel is at the
+         legacy ports, where we drive it. */
+      c->bm_base = 0;
+      c->prdt = NULL;
+      if (bm_base != 0 && !(pci.prog_if & PCI_IDE_NATIVE (chan_no)))
+        {
+          c->prdt = palloc_get_page (0);
+          if (c->prdt != NULL)
+            c->bm_base = bm_base + 8 * chan_no;
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +263,9 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
+          d->block = NULL;
         }
 
       /* Register interrupt handler. */
@@ -261,7 +391,9 @@ identify_ata_device (struct ata_disk *d)
 {
   struct channel *c = d->channel;
   char id[BLOCK_SECTOR_SIZE];
+  const uint16_t *words = (const uint16_t *) id;
   block_sector_t capacity;
+  uint64_t sectors;
   char *model, *serial;
   char extra_info[128];
   struct block *block;
@@ -272,7 +404,7 @@ identify_ata_device (struct ata_disk *d)
      indicating the device's response is ready, and read the data
      into our buffer. */
   select_device_wait (d);
-  issue_pio_command (c, CMD_IDENTIFY_DEVICE);
+  issue_command (c, CMD_IDENTIFY_DEVICE);
   sema_down (&c->completion_wait);
   if (!wait_while_busy (d))
     {
@@ -281,9 +413,23 @@ identify_ata_device (struct ata_disk *d)
     }
   input_sector (c, id);
 
-  /* Calculate capacity.
+  /* Calculate capacity: words 100...103 hold the 48-bit
+     capacity of a disk that supports 48-bit LBA (word 83 bit 10),
+     words 60...61 hold the 28-bit capacity otherwise.
      Read model name and serial number. */
-  capacity = *(uint32_t *) &id[60 * 2];
+  d->lba48 = (words[83] & (1 << 10)) != 0;
+  if (d->lba48)
+    sectors = (words[100] | (uint64_t) words[101] << 16
+               | (uint64_t) words[102] << 32 | (uint64_t) words[103] << 48);
+  else
+    sectors = *(uint32_t *) &id[60 * 2];
+  if (sectors > (block_sector_t) -1)
+    {
+      printf ("%s: using only the first %'"PRDSNu" sectors\n",
+              d->name, (block_sector_t) -1);
+      sectors = (block_sector_t) -1;
+    }
+  capacity = sectors;
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
   snprintf (extra_info, sizeof extra_info,
@@ -292,23 +438,56 @@ identify_ata_device (struct ata_disk *d)
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
      allow access to those, we're less likely to scribble on
-     someone's important data.  You can disable this check by
-     hand if you really want to do so. */
-  if (capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE)
+     someone's important data.  The "-ide-large" option disables
+     this check for those who really want to do so. */
+  if (capacity >= 1024 * 1024 * 1024 / BLOCK_SECTOR_SIZE
+      && !allow_large_disks)
     {
       printf ("%s: ignoring ", d->name);
-      print_human_readable_size (capacity * 512);
-      printf ("disk for safety\n");
+      print_human_readable_size ((uint64_t) capacity * BLOCK_SECTOR_SIZE);
+      printf ("disk for safety (use -ide-large to allow)\n");
       d->is_ata = false;
       return;
     }
 
+  set_multiple_mode (d, words);
+
+  /* Use DMA if both the channel and the disk support it. */
+  d->dma = c->bm_base != 0 && (words[49] & (1 << 8));
+
   /* Register. */
   block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
                           &ide_operations, d);
+  d->block = block;
   partition_scan (block);
 }
 
+/* Enables READ MULTIPLE and WRITE MULTIPLE on disk D, whose
+   IDENTIFY DEVICE response is ID, with as many sectors per
+   interrupt as D allows, and records that number in D.  Leaves
+   them disabled if D does not support them. */
+static void
+set_multiple_mode (struct ata_disk *d, const uint16_t *id)
+{
+  struct channel *c = d->channel;
+  int max = id[47] & 0xff;
+  int multiple;
+
+  /* Use the largest power of 2 that the disk allows. */
+  if (max == 0)
+    return;
+  for (multiple = 1; multiple * 2 <= max; multiple *= 2)
+    continue;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), multiple);
+  issue_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  if ((inb (reg_status (c)) & STA_ERR) == 0)
+    d->multiple = multiple;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -337,79 +516,309 @@ descramble_ata_string (char *string, int size)
   return string;
 }
 
-/* Reads sector SEC_NO from disk D into BUFFER, which must have
-   room for BLOCK_SECTOR_SIZE bytes.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
+/* Starts the requests queued on disk D unless its channel is
+   already busy, in which case the channel's interrupt handler
+   gets to them.  Called by the block layer with interrupts
+   off. */
 static void
-ide_read (void *d_, block_sector_t sec_no, void *buffer)
+ide_start (void *d_)
 {
   struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
-}
 
-/* Write sector SEC_NO to disk D from BUFFER, which must contain
-   BLOCK_SECTOR_SIZE bytes.  Returns after the disk has
-   acknowledged receiving the data.
-   Internally synchronizes accesses to disks, so external
-   per-disk locking is unneeded. */
-static void
-ide_write (void *d_, block_sector_t sec_no, const void *buffer)
-{
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
-  lock_release (&c->lock);
+  if (d->channel->active == NULL)
+    channel_start (d->channel);
 }
 
 static struct block_operations ide_operations =
   {
-    ide_read,
-    ide_write
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    ide_start,
+    NULL
   };
-
-/* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+
+/* Starts transferring the next requests queued for one of the
+   disks on idle channel C, if there are any, taking turns
+   between the disks when both have work. */
+static void
+channel_start (struct channel *c)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (c->active == NULL);
+
+  for (i = 0; i < 2; i++)
+    {
+      struct ata_disk *d = &c->devices[(c->next_dev + i) % 2];
+      struct block_request *r;
+
+      if (d->block == NULL || (r = block_dequeue (d->block)) == NULL)
+        continue;
+
+      c->active = d;
+      c->requests = r;
+      c->write = r->write;
+      c->sec_no = r->sector;
+      for (c->left = 0; r != NULL; r = r->next)
+        c->left += r->cnt;
+      block_cursor_init (&c->cursor, c->requests);
+      c->next_dev = !d->dev_no;
+      command_start (c);
+      return;
+    }
+}
+
+/* Issues the command for the next sectors, at most
+   MAX_XFER_SECTORS, of channel C's transfer: by DMA if the disk
+   supports it, otherwise by PIO. */
+static void
+command_start (struct channel *c)
+{
+  c->cmd_cnt = c->left < MAX_XFER_SECTORS ? c->left : MAX_XFER_SECTORS;
+  c->cmd_start = c->cursor;
+  c->cmd_dma = c->active->dma;
+  if (c->cmd_dma)
+    dma_start (c);
+  else
+    pio_start (c);
+}
+
+/* Issues a PIO command for channel C's current sectors.  The disk
+   interrupts once per block of D->multiple sectors if READ/WRITE
+   MULTIPLE is enabled, otherwise once per sector: for a read,
+   when the block is ready to be taken; for a write, when the
+   disk has accepted the previous block. */
+static void
+pio_start (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  bool ext;
+
+  c->cmd_left = c->cmd_cnt;
+  ext = select_sector (d, c->sec_no, c->cmd_cnt);
+  if (!c->write)
+    issue_command (c, (d->multiple > 0
+                       ? (ext ? CMD_READ_MULTIPLE_EXT : CMD_READ_MULTIPLE)
+                       : (ext ? CMD_READ_SECTOR_EXT : CMD_READ_SECTOR_RETRY)));
+  else
+    {
+      issue_command (c, (d->multiple > 0
+                         ? (ext ? CMD_WRITE_MULTIPLE_EXT : CMD_WRITE_MULTIPLE)
+                         : (ext ? CMD_WRITE_SECTOR_EXT
+                            : CMD_WRITE_SECTOR_RETRY)));
+
+      /* The disk asks for the first block without an interrupt. */
+      pio_output_block (c);
+    }
+}
+
+/* Reads the next block of channel C's current PIO command from
+   the disk. */
+static void
+pio_input_block (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  size_t block = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t n = c->cmd_left < block ? c->cmd_left : block;
+
+  if (!wait_for_data (d))
+    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, c->sec_no);
+  for (c->cmd_left -= n; n > 0; n--)
+    input_sector (c, block_cursor_next (&c->cursor));
+}
+
+/* Writes the next block of channel C's current PIO command to
+   the disk. */
+static void
+pio_output_block (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  size_t block = d->multiple > 0 ? (size_t) d->multiple : 1;
+  size_t n = c->cmd_left < block ? c->cmd_left : block;
+
+  if (!wait_for_data (d))
+    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, c->sec_no);
+  for (c->cmd_left -= n; n > 0; n--)
+    output_sector (c, block_cursor_next (&c->cursor));
+}
+
+/* Appends the SIZE bytes at physical address ADDR to the PRD
+   table of channel C, which has *CNT entries so far.  Extends the
+   last entry when ADDR follows it directly, and splits the bytes
+   at 64 kB boundaries, which no entry may cross. */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+prd_add (struct channel *c, size_t *cnt, uintptr_t addr, size_t size)
+{
+  while (size > 0)
+    {
+      size_t room = 0x10000 - (addr & 0xffff);
+      size_t n = size < room ? size : room;
+      struct prd *last = *cnt > 0 ? &c->prdt[*cnt - 1] : NULL;
+
+      if (last != NULL && (addr & 0xffff) != 0
+          && last->addr + last->size == addr)
+        last->size += n;
+      else
+        {
+          ASSERT (*cnt < PRD_MAX);
+          last = &c->prdt[(*cnt)++];
+          last->addr = addr;
+          last->size = n;
+          last->flags = 0;
+        }
+      addr += n;
+      size -= n;
+    }
+}
+
+/* Starts a bus master DMA transfer of channel C's current
+   sectors.  The disk interrupts once, when it is done. */
+static void
+dma_start (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+  uint8_t direction = c->write ? 0 : BM_CMD_READ;
+  size_t prd_cnt = 0;
+  size_t i;
+  bool ext;
+
+  /* Describe the buffers.  An entry that covers a whole 64 kB
+     window wraps its size to 0, which is how a PRD says 64 kB. */
+  for (i = 0; i < c->cmd_cnt; i++)
+    prd_add (c, &prd_cnt, vtop (block_cursor_next (&c->cursor)),
+             BLOCK_SECTOR_SIZE);
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+  /* Program the controller, then the disk, then start. */
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_COMMAND, direction);
+  outb (c->bm_base + BM_STATUS, BM_STA_ERROR | BM_STA_INTR);
+  ext = select_sector (d, c->sec_no, c->cmd_cnt);
+  if (c->write)
+    issue_command (c, ext ? CMD_WRITE_DMA_EXT : CMD_WRITE_DMA);
+  else
+    issue_command (c, ext ? CMD_READ_DMA_EXT : CMD_READ_DMA);
+  outb (c->bm_base + BM_COMMAND, direction | BM_CMD_START);
+}
+
+/* Stops channel C's DMA engine after the completion interrupt.
+   Returns false if the controller or the disk reports an
+   error. */
+static bool
+dma_finish (struct channel *c)
+{
+  uint8_t bm_status, status;
+
+  outb (c->bm_base + BM_COMMAND, c->write ? 0 : BM_CMD_READ);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS, BM_STA_ERROR | BM_STA_INTR);
+  status = inb (reg_alt_status (c));
+  return !(bm_status & BM_STA_ERROR) && !(status & (STA_BSY | STA_ERR));
+}
+
+/* Carries on channel C's transfer after an interrupt from the
+   disk: moves the next PIO block, or issues the next command, or
+   completes the requests and starts the next ones.  A failed DMA
+   command is retried with PIO, which the disk then keeps
+   using. */
+static void
+transfer_interrupt (struct channel *c)
+{
+  struct ata_disk *d = c->active;
+
+  if (c->cmd_dma)
+    {
+      if (!dma_finish (c))
+        {
+          printf ("%s: DMA %s failed, sector=%"PRDSNu"; using PIO\n",
+                  d->name, c->write ? "write" : "read", c->sec_no);
+          d->dma = false;
+          c->cursor = c->cmd_start;
+          command_start (c);
+          return;
+        }
+    }
+  else if (!c->write)
+    {
+      pio_input_block (c);
+      if (c->cmd_left > 0)
+        return;
+    }
+  else if (c->cmd_left > 0)
+    {
+      pio_output_block (c);
+      return;
+    }
+  else if (inb (reg_alt_status (c)) & STA_ERR)
+    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, c->sec_no);
+
+  /* The command is done. */
+  c->sec_no += c->cmd_cnt;
+  c->left -= c->cmd_cnt;
+  if (c->left > 0)
+    command_start (c);
+  else
+    {
+      struct block_request *requests = c->requests;
+
+      c->active = NULL;
+      channel_start (c);
+      block_complete (d->block, requests);
+    }
+}
+
+/* Selects device D, waiting for it to become ready, and then
+   writes SEC_NO and the count CNT, from 1 to MAX_XFER_SECTORS, to
+   the disk's sector selection registers.  (We use LBA mode.)
+   Sectors beyond the reach of 28-bit LBA are selected with
+   48-bit LBA, which only the EXT commands understand; returns
+   true in that case. */
+static bool
+select_sector (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
+  bool ext = (uint64_t) sec_no + cnt > (1UL << 28);
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (!ext || d->lba48);
+  ASSERT (cnt > 0 && cnt <= MAX_XFER_SECTORS);
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
-  outb (reg_lbal (c), sec_no);
-  outb (reg_lbam (c), sec_no >> 8);
-  outb (reg_lbah (c), (sec_no >> 16));
-  outb (reg_device (c),
-        DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0) | (sec_no >> 24));
+  if (ext)
+    {
+      /* Each register holds two bytes, written high byte first.
+         Sector numbers never need LBA bits 32...47. */
+      outb (reg_nsect (c), cnt >> 8);
+      outb (reg_lbal (c), sec_no >> 24);
+      outb (reg_lbam (c), 0);
+      outb (reg_lbah (c), 0);
+      outb (reg_nsect (c), cnt);
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), sec_no >> 16);
+      outb (reg_device (c),
+            DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0));
+    }
+  else
+    {
+      outb (reg_nsect (c), cnt);          /* 256 is written as 0. */
+      outb (reg_lbal (c), sec_no);
+      outb (reg_lbam (c), sec_no >> 8);
+      outb (reg_lbah (c), (sec_no >> 16));
+      outb (reg_device (c),
+            DEV_MBS | DEV_LBA | (d->dev_no == 1 ? DEV_DEV : 0)
+            | (sec_no >> 24));
+    }
+  return ext;
 }
 
 /* Writes COMMAND to channel C and prepares for receiving a
    completion interrupt. */
 static void
-issue_pio_command (struct channel *c, uint8_t command) 
+issue_command (struct channel *c, uint8_t command) 
 {
-  /* Interrupts must be enabled or our semaphore will never be
-     up'd by the completion handler. */
-  ASSERT (intr_get_level () == INTR_ON);
-
   c->expecting_interrupt = true;
   outb (reg_command (c), command);
 }
@@ -446,7 +855,7 @@ wait_until_idle (const struct ata_disk *d)
     {
       if ((inb (reg_status (d->channel)) & (STA_BSY | STA_DRQ)) == 0)
         return;
-      timer_usleep (10);
+      timer_udelay (10);
     }
 
   printf ("%s: idle timeout\n", d->name);
@@ -479,6 +888,26 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Wait up to a second for disk D to clear BSY, and then return
+   whether it is ready to move data, with DRQ set and ERR clear.
+   Unlike wait_while_busy(), does not sleep, so it may be used
+   with interrupts off. */
+static bool
+wait_for_data (const struct ata_disk *d)
+{
+  struct channel *c = d->channel;
+  int i;
+
+  for (i = 0; i < 100000; i++)
+    {
+      uint8_t status = inb (reg_alt_status (c));
+      if (!(status & STA_BSY))
+        return (status & (STA_DRQ | STA_ERR)) == STA_DRQ;
+      timer_udelay (10);
+    }
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -489,7 +918,7 @@ select_device (const struct ata_disk *d)
     dev |= DEV_DEV;
   outb (reg_device (c), dev);
   inb (reg_alt_status (c));
-  timer_nsleep (400);
+  timer_ndelay (400);
 }
 
 /* Select disk D in its channel, as select_device(), but wait for
@@ -514,7 +943,10 @@ interrupt_handler (struct intr_frame *f)
         if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            if (c->active != NULL)
+              transfer_interrupt (c);           /* Carry on transfer. */
+            else
+              sema_up (&c->completion_wait);    /* Wake up waiter. */
           }
         else
           printf ("%s: unexpected interrupt\n", c->name);
@@ -1,6 +1,7 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+void ide_allow_large_disks (void);
 void ide_init (void);
 
 #endif /* devices/ide.h */
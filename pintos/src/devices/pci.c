@@ -0,0 +1,273 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include <round.h>
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/loader.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* The code in this file reads and writes PCI configuration space
+   through the configuration mechanism #1 ports, which is enough
+   to find the handful of controllers that Pintos drives. */
+
+/* Configuration mechanism #1 ports. */
+#define PCI_CONFIG_ADDR 0xcf8           /* Address of register to access. */
+#define PCI_CONFIG_DATA 0xcfc           /* Data of the selected register. */
+
+/* Header type bit for devices with more than one function. */
+#define PCI_HEADER_MULTI 0x80
+
+/* Device memory is mapped into the top 4 MB of the kernel's
+   address space, one page directory entry's worth, handed out
+   from the bottom up. */
+#define MMIO_BASE 0xffc00000
+static uintptr_t mmio_next = MMIO_BASE;
+
+/* PCI interrupt lines may be shared among devices, and among
+   drivers, so each line in use gets a single dispatcher that
+   calls every handler registered for it. */
+#define PCI_IRQ_MAX 16                  /* Most handlers, all lines. */
+struct pci_irq_handler
+  {
+    uint8_t vec_no;                     /* Interrupt vector. */
+    pci_irq_func *func;                 /* Handler. */
+    void *aux;                          /* Its argument. */
+  };
+static struct pci_irq_handler irq_handlers[PCI_IRQ_MAX];
+static size_t irq_handler_cnt;
+
+static void pci_interrupt (struct intr_frame *);
+
+typedef bool match_func (const struct pci_dev *, const void *aux);
+static bool scan (match_func *, const void *aux, int start,
+                  struct pci_dev *);
+
+/* Returns the configuration space register REG, which must be
+   4-byte aligned, of function FUNC of device DEV on bus BUS. */
+static uint32_t
+read_config (int bus, int dev, int func, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDR, (0x80000000u | (bus << 16) | (dev << 11)
+                          | (func << 8) | reg));
+  return inl (PCI_CONFIG_DATA);
+}
+
+/* Returns configuration space register REG of D. */
+uint32_t
+pci_read_config (const struct pci_dev *d, uint8_t reg)
+{
+  return read_config (d->bus, d->dev, d->func, reg);
+}
+
+/* Sets configuration space register REG of D to VALUE. */
+void
+pci_write_config (const struct pci_dev *d, uint8_t reg, uint32_t value)
+{
+  ASSERT (reg % 4 == 0);
+  outl (PCI_CONFIG_ADDR, (0x80000000u | (d->bus << 16) | (d->dev << 11)
+                          | (d->func << 8) | reg));
+  outl (PCI_CONFIG_DATA, value);
+}
+
+/* Returns base address register BAR, 0 through 5, of D, without
+   the low bits that describe it: an I/O port for an I/O space
+   BAR, a physical address for a memory BAR. */
+uint32_t
+pci_bar (const struct pci_dev *d, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+  value = pci_read_config (d, PCI_REG_BAR0 + bar * 4);
+  return value & 1 ? value & ~0x3u : value & ~0xfu;
+}
+
+/* Returns the interrupt line, 0 through 15, that D uses. */
+uint8_t
+pci_irq (const struct pci_dev *d)
+{
+  return pci_read_config (d, PCI_REG_INTR) & 0xff;
+}
+
+/* Arranges for FUNC to be called with AUX whenever D's interrupt
+   line is raised, whether by D or by another device sharing it.
+   NAME is used for debugging if FUNC is the first handler on
+   the line. */
+void
+pci_register_irq (const struct pci_dev *d, pci_irq_func *func, void *aux,
+                  const char *name)
+{
+  uint8_t vec_no = pci_irq (d) + 0x20;
+  struct pci_irq_handler *h;
+  enum intr_level old_level;
+  bool first = true;
+  size_t i;
+
+  if (irq_handler_cnt >= PCI_IRQ_MAX)
+    PANIC ("too many PCI interrupt handlers");
+  for (i = 0; i < irq_handler_cnt; i++)
+    if (irq_handlers[i].vec_no == vec_no)
+      first = false;
+
+  old_level = intr_disable ();
+  h = &irq_handlers[irq_handler_cnt++];
+  h->vec_no = vec_no;
+  h->func = func;
+  h->aux = aux;
+  if (first)
+    intr_register_ext (vec_no, pci_interrupt, name);
+  intr_set_level (old_level);
+}
+
+/* Calls every handler registered for the line that interrupted. */
+static void
+pci_interrupt (struct intr_frame *f)
+{
+  size_t i;
+
+  for (i = 0; i < irq_handler_cnt; i++)
+    if (irq_handlers[i].vec_no == f->vec_no)
+      irq_handlers[i].func (irq_handlers[i].aux);
+}
+
+/* Sets the bits in COMMAND, a combination of PCI_CMD_* flags, in
+   D's command register. */
+void
+pci_enable (const struct pci_dev *d, uint16_t command)
+{
+  uint32_t value = pci_read_config (d, PCI_REG_COMMAND);
+  pci_write_config (d, PCI_REG_COMMAND, value | command);
+}
+
+/* Matches a function by class and subclass. */
+static bool
+match_class (const struct pci_dev *d, const void *aux)
+{
+  const uint8_t *cls = aux;
+  return d->class == cls[0] && d->subclass == cls[1];
+}
+
+/* Finds the first function with the given CLASS and SUBCLASS and
+   stores it in *D.  Returns false if there is none. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_dev *d)
+{
+  uint8_t cls[2] = { class, subclass };
+  return scan (match_class, cls, 0, d);
+}
+
+/* Matches a function by vendor and device ID. */
+static bool
+match_device (const struct pci_dev *d, const void *aux)
+{
+  const uint16_t *id = aux;
+  return d->vendor_id == id[0] && d->device_id == id[1];
+}
+
+/* Finds the first function with the given VENDOR_ID and
+   DEVICE_ID and stores it in *D.  Returns false if there is
+   none. */
+bool
+pci_find_device (uint16_t vendor_id, uint16_t device_id, struct pci_dev *d)
+{
+  uint16_t id[2] = { vendor_id, device_id };
+  return scan (match_device, id, 0, d);
+}
+
+/* Finds the next function after *D, in scan order, with the
+   same vendor and device IDs as *D, and stores it in *D.
+   Returns false if there is none. */
+bool
+pci_find_next (struct pci_dev *d)
+{
+  uint16_t id[2] = { d->vendor_id, d->device_id };
+  int slot = (d->bus << 8) | (d->dev << 3) | d->func;
+  return scan (match_device, id, slot + 1, d);
+}
+
+/* Walks every function on every bus, starting from slot START,
+   where a function's slot is its bus, device, and function
+   numbers packed as 8:5:3 bits, and stores the first one for
+   which MATCH returns true in *D.  Returns false if none
+   matches. */
+static bool
+scan (match_func *match, const void *aux, int start, struct pci_dev *d)
+{
+  int slot;
+
+  for (slot = start; slot < 256 * 32 * 8; slot++)
+    {
+      int bus = slot >> 8, dev = (slot >> 3) & 31, func = slot & 7;
+      uint32_t id = read_config (bus, dev, func, PCI_REG_ID);
+      uint32_t class;
+
+      if ((id & 0xffff) == 0xffff)
+        {
+          /* No such function.  Without function 0 there are no
+             others. */
+          if (func == 0)
+            slot |= 7;
+          continue;
+        }
+
+      class = read_config (bus, dev, func, PCI_REG_CLASS);
+      d->bus = bus;
+      d->dev = dev;
+      d->func = func;
+      d->vendor_id = id & 0xffff;
+      d->device_id = id >> 16;
+      d->class = class >> 24;
+      d->subclass = class >> 16;
+      d->prog_if = class >> 8;
+      if (match (d, aux))
+        return true;
+
+      /* Only multi-function devices have functions past 0. */
+      if (func == 0
+          && !(read_config (bus, dev, 0, PCI_REG_HEADER)
+               & (PCI_HEADER_MULTI << 16)))
+        slot |= 7;
+    }
+  return false;
+}
+
+/* Maps the SIZE bytes of device memory at physical address PHYS
+   into the kernel's address space with caching disabled and
+   returns the kernel virtual address of PHYS.  Panics if the
+   mapping area is exhausted.
+
+   Must be called during boot, before any process exists, because
+   each process's page directory copies the kernel's mappings when
+   it is created. */
+void *
+pci_map_mmio (uint32_t phys, size_t size)
+{
+  uint32_t ofs = phys & PGMASK;
+  size_t page_cnt = DIV_ROUND_UP (ofs + size, PGSIZE);
+  uintptr_t vaddr = mmio_next;
+  size_t i;
+
+  ASSERT ((uintptr_t) ptov (init_ram_pages * PGSIZE) <= MMIO_BASE);
+  if (page_cnt > (0x100000000ull - mmio_next) / PGSIZE)
+    PANIC ("out of address space mapping %zu bytes of device memory",
+           size);
+
+  for (i = 0; i < page_cnt; i++)
+    {
+      void *page = (void *) (vaddr + i * PGSIZE);
+      uint32_t *pde = init_page_dir + pd_no (page);
+      uint32_t *pt;
+
+      if (*pde == 0)
+        *pde = pde_create (palloc_get_page (PAL_ASSERT | PAL_ZERO));
+      pt = pde_get_pt (*pde);
+      pt[pt_no (page)] = ((phys - ofs + i * PGSIZE)
+                          | PTE_P | PTE_W | PTE_PCD | PTE_PWT);
+    }
+  mmio_next += page_cnt * PGSIZE;
+  return (void *) (vaddr + ofs);
+}
@@ -0,0 +1,242 @@
+#include "devices/ramdisk.h"
+#include <ctype.h>
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <ustar.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/vaddr.h"
+
+/* RAM disks.
+
+   A RAM disk is a block device whose sectors live in kernel
+   pages, which lets file system and VM costs be measured without
+   the latency of an emulated disk.  Each one is requested on the
+   kernel command line with -ramdisk=ROLE:SIZE[:BDEV], created by
+   ramdisk_init() after the other block devices have been probed,
+   and preferred for ROLE by locate_block_devices().  If BDEV is
+   given, the ustar archive at its start, such as the one the
+   `pintos' script puts on the scratch disk, is copied into the
+   RAM disk.  The contents are lost at power off. */
+
+/* Sectors per backing page. */
+#define SECTORS_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
+
+/* A RAM disk. */
+struct ramdisk
+  {
+    enum block_type role;       /* Role to fill. */
+    size_t page_cnt;            /* Size in pages. */
+    const char *source;         /* Device to preload from, or null. */
+    uint8_t **pages;            /* Backing pages. */
+    struct block *block;        /* Registered block device. */
+  };
+
+/* Configured RAM disks, at most one per role. */
+static struct ramdisk ramdisks[BLOCK_ROLE_CNT];
+static size_t ramdisk_cnt;
+
+static struct block_operations ramdisk_operations;
+
+static size_t parse_size (const char *);
+static void preload (struct ramdisk *);
+
+/* Adds a RAM disk described by SPEC, the value of a -ramdisk
+   option, which has the form ROLE:SIZE[:BDEV].  ROLE is
+   "filesys", "scratch", or "swap"; SIZE is in bytes, with an
+   optional K or M suffix, and is rounded up to whole pages; BDEV
+   names the block device to preload from.  Modifies SPEC.
+   Panics if SPEC is malformed. */
+void
+ramdisk_configure (char *spec)
+{
+  struct ramdisk *rd;
+  char *role, *size, *save_ptr;
+  enum block_type type;
+
+  role = spec != NULL ? strtok_r (spec, ":", &save_ptr) : NULL;
+  size = role != NULL ? strtok_r (NULL, ":", &save_ptr) : NULL;
+  if (size == NULL)
+    PANIC ("-ramdisk: expected ROLE:SIZE[:BDEV]");
+
+  for (type = 0; type < BLOCK_ROLE_CNT; type++)
+    if (!strcmp (role, block_type_name (type)))
+      break;
+  if (type == BLOCK_KERNEL || type == BLOCK_ROLE_CNT)
+    PANIC ("-ramdisk: bad role `%s'", role);
+  if (ramdisk_get (type) != NULL)
+    PANIC ("-ramdisk: more than one RAM disk for %s", role);
+
+  rd = &ramdisks[ramdisk_cnt++];
+  rd->role = type;
+  rd->page_cnt = DIV_ROUND_UP (parse_size (size), PGSIZE);
+  rd->source = strtok_r (NULL, "", &save_ptr);
+  rd->pages = NULL;
+  rd->block = NULL;
+  if (rd->page_cnt == 0)
+    PANIC ("-ramdisk: size must be positive");
+}
+
+/* Creates and registers the configured RAM disks, preloading
+   them as requested.  Must be called after the devices to
+   preload from are registered. */
+void
+ramdisk_init (void)
+{
+  size_t i, j;
+
+  for (i = 0; i < ramdisk_cnt; i++)
+    {
+      struct ramdisk *rd = &ramdisks[i];
+      char name[16];
+
+      rd->pages = malloc (rd->page_cnt * sizeof *rd->pages);
+      if (rd->pages == NULL)
+        PANIC ("ram%zu: out of memory", i);
+      for (j = 0; j < rd->page_cnt; j++)
+        {
+          rd->pages[j] = palloc_get_page (PAL_ZERO);
+          if (rd->pages[j] == NULL)
+            PANIC ("ram%zu: out of memory after %zu of %zu pages",
+                   i, j, rd->page_cnt);
+        }
+
+      snprintf (name, sizeof name, "ram%zu", i);
+      rd->block = block_register (name, rd->role, "RAM disk",
+                                  rd->page_cnt * SECTORS_PER_PAGE,
+                                  &ramdisk_operations, rd);
+      if (rd->source != NULL)
+        preload (rd);
+    }
+}
+
+/* Returns the RAM disk configured for ROLE, or a null pointer if
+   there is none or it has not been created yet. */
+struct block *
+ramdisk_get (enum block_type role)
+{
+  size_t i;
+
+  for (i = 0; i < ramdisk_cnt; i++)
+    if (ramdisks[i].role == role)
+      return ramdisks[i].block;
+  return NULL;
+}
+
+/* Parses S, a size in bytes with an optional K or M suffix.
+   Panics if S is malformed. */
+static size_t
+parse_size (const char *s)
+{
+  size_t size = 0;
+
+  if (!isdigit (*s))
+    PANIC ("-ramdisk: bad size `%s'", s);
+  for (; isdigit (*s); s++)
+    size = size * 10 + (*s - '0');
+  if (*s == 'K' || *s == 'k')
+    size *= 1024, s++;
+  else if (*s == 'M' || *s == 'm')
+    size *= 1024 * 1024, s++;
+  if (*s != '\0')
+    PANIC ("-ramdisk: bad size suffix `%s'", s);
+  return size;
+}
+
+/* Returns the address of SECTOR within RD. */
+static uint8_t *
+sector_addr (struct ramdisk *rd, block_sector_t sector)
+{
+  return (rd->pages[sector / SECTORS_PER_PAGE]
+          + sector % SECTORS_PER_PAGE * BLOCK_SECTOR_SIZE);
+}
+
+/* Copies the ustar archive at the start of block device
+   RD->source into the same sectors of RD, up to and including
+   its end-of-archive block.  Panics if the archive is corrupt or
+   does not fit. */
+static void
+preload (struct ramdisk *rd)
+{
+  struct block *src = block_get_by_name (rd->source);
+  block_sector_t size = block_size (rd->block);
+  block_sector_t sector = 0;
+
+  if (src == NULL)
+    PANIC ("%s: no such block device \"%s\"",
+           block_name (rd->block), rd->source);
+  if (block_size (src) < size)
+    size = block_size (src);
+
+  /* Copy each header and the data that follows it.  A device
+     without an end-of-archive block ends the archive. */
+  while (sector < block_size (src))
+    {
+      const char *file_name, *error;
+      enum ustar_type type;
+      block_sector_t data_cnt;
+      int file_size;
+
+      if (sector >= size)
+        PANIC ("%s: too small for archive on %s",
+               block_name (rd->block), rd->source);
+      block_read (src, sector, sector_addr (rd, sector));
+      error = ustar_parse_header ((const char *) sector_addr (rd, sector),
+                                  &file_name, &type, &file_size);
+      if (error != NULL)
+        PANIC ("%s: bad archive header at %s sector %"PRDSNu" (%s)",
+               block_name (rd->block), rd->source, sector, error);
+      sector++;
+      if (type == USTAR_EOF)
+        break;
+
+      data_cnt = DIV_ROUND_UP (file_size, BLOCK_SECTOR_SIZE);
+      if (data_cnt > size - sector)
+        PANIC ("%s: too small for archive on %s",
+               block_name (rd->block), rd->source);
+      while (data_cnt > 0)
+        {
+          struct block_iovec iov;
+
+          /* Read up to the end of the current page at once. */
+          iov.base = sector_addr (rd, sector);
+          iov.cnt = SECTORS_PER_PAGE - sector % SECTORS_PER_PAGE;
+          if (iov.cnt > data_cnt)
+            iov.cnt = data_cnt;
+          block_read_multi (src, sector, &iov, 1);
+          sector += iov.cnt;
+          data_cnt -= iov.cnt;
+        }
+    }
+
+  printf ("%s: preloaded %'"PRDSNu" sectors from %s\n",
+          block_name (rd->block), sector, rd->source);
+}
+
+/* Reads sector SECTOR from RAM disk RD into BUFFER, which must
+   have room for BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_read (void *rd, block_sector_t sector, void *buffer)
+{
+  memcpy (buffer, sector_addr (rd, sector), BLOCK_SECTOR_SIZE);
+}
+
+/* Writes sector SECTOR to RAM disk RD from BUFFER, which must
+   contain BLOCK_SECTOR_SIZE bytes. */
+static void
+ramdisk_write (void *rd, block_sector_t sector, const void *buffer)
+{
+  memcpy (sector_addr (rd, sector), buffer, BLOCK_SECTOR_SIZE);
+}
+
+static struct block_operations ramdisk_operations =
+  {
+    ramdisk_read,
+    ramdisk_write,
+    NULL,
+    NULL,
+    NULL,
+    NULL
+  };
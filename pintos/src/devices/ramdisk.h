@@ -0,0 +1,10 @@
+#ifndef DEVICES_RAMDISK_H
+#define DEVICES_RAMDISK_H
+
+#include "devices/block.h"
+
+void ramdisk_configure (char *spec);
+void ramdisk_init (void);
+struct block *ramdisk_get (enum block_type role);
+
+#endif /* devices/ramdisk.h */
@@ -0,0 +1,481 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices, such as QEMU attaches with
+   "-drive if=virtio", through the legacy PCI interface of
+   [VIRTIO] 0.9.5.
+
+   The driver and the device share a split virtqueue: a table of
+   buffer descriptors, an "available" ring in which the driver
+   posts chains of descriptors, and a "used" ring in which the
+   device hands them back.  Each virtio request is a chain of a
+   header, one descriptor per physically contiguous piece of the
+   data, and a status byte.  The driver takes requests from the
+   block layer's queue and posts as many as the descriptor table
+   holds, so the device can work on several at once, and
+   completes them from the interrupt handler.  A dispatch whose
+   buffers need more descriptors than one virtio request may use
+   is sent as several. */
+
+/* PCI IDs of a legacy virtio block device. */
+#define VIRTIO_VENDOR_ID 0x1af4
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy virtio registers, as offsets from the I/O BAR. */
+#define VIRTIO_REG_HOST_FEATURES 0x00   /* Device features (r/o). */
+#define VIRTIO_REG_GUEST_FEATURES 0x04  /* Driver features. */
+#define VIRTIO_REG_QUEUE_PFN 0x08       /* Page number of queue. */
+#define VIRTIO_REG_QUEUE_SIZE 0x0c      /* Entries in queue (r/o). */
+#define VIRTIO_REG_QUEUE_SELECT 0x0e    /* Queue for above registers. */
+#define VIRTIO_REG_QUEUE_NOTIFY 0x10    /* Queue to check (w/o). */
+#define VIRTIO_REG_STATUS 0x12          /* Device status. */
+#define VIRTIO_REG_ISR 0x13             /* Interrupt status (r/o). */
+#define VIRTIO_REG_CAPACITY 0x14        /* Size in sectors, 64 bits. */
+
+/* Device status bits. */
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01  /* Driver found the device. */
+#define VIRTIO_STATUS_DRIVER 0x02       /* Driver can drive it. */
+#define VIRTIO_STATUS_DRIVER_OK 0x04    /* Driver is ready. */
+
+/* Interrupt status bit. */
+#define VIRTIO_ISR_QUEUE 0x01           /* A queue has used buffers. */
+
+/* Descriptor, available ring, and used ring of a virtqueue. */
+struct vring_desc
+  {
+    uint64_t addr;              /* Physical address of buffer. */
+    uint32_t len;               /* Length of buffer. */
+    uint16_t flags;             /* VRING_DESC_F_* flags. */
+    uint16_t next;              /* Next descriptor, if F_NEXT. */
+  };
+#define VRING_DESC_F_NEXT 1     /* Chain continues in NEXT. */
+#define VRING_DESC_F_WRITE 2    /* Device writes the buffer. */
+
+struct vring_avail
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where driver puts next entry. */
+    uint16_t ring[];            /* Heads of descriptor chains. */
+  };
+
+struct vring_used_elem
+  {
+    uint32_t id;                /* Head of descriptor chain. */
+    uint32_t len;               /* Bytes written by device. */
+  };
+
+struct vring_used
+  {
+    uint16_t flags;
+    uint16_t idx;               /* Where device puts next entry. */
+    struct vring_used_elem ring[];
+  };
+
+/* Header of a virtio block request. */
+struct virtio_blk_header
+  {
+    uint32_t type;              /* VIRTIO_BLK_T_*. */
+    uint32_t reserved;
+    uint64_t sector;            /* First sector. */
+  };
+#define VIRTIO_BLK_T_IN 0       /* Read. */
+#define VIRTIO_BLK_T_OUT 1      /* Write. */
+#define VIRTIO_BLK_S_OK 0       /* Status of a successful request. */
+
+/* Most data descriptors in one virtio request. */
+#define VBLK_MAX_SEGS 64
+
+/* Most virtio block devices supported. */
+#define VBLK_MAX 4
+
+/* A dispatch from the block layer: a chain of requests covering
+   consecutive sectors, sent as one or more virtio requests. */
+struct vblk_xfer
+  {
+    struct block_request *requests;     /* Requests, or null if free. */
+    bool write;                 /* Transfer to device? */
+    block_sector_t sector;      /* Next sector to send. */
+    size_t left;                /* Sectors not yet sent. */
+    struct block_cursor cursor; /* Buffer of next sector to send. */
+    int outstanding;            /* Virtio requests sent, not yet used. */
+  };
+
+/* The part of a virtio request that is not data, kept for the
+   descriptor chain with the same head. */
+struct vblk_slot
+  {
+    struct virtio_blk_header header;    /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+    struct vblk_xfer *xfer;             /* Dispatch it belongs to. */
+  };
+
+/* A virtio block device.
+   Members below BLOCK are accessed only with interrupts off. */
+struct vblk
+  {
+    char name[8];               /* Name, e.g. "vda". */
+    uint16_t io_base;           /* Base of legacy registers. */
+    struct block *block;        /* Registered block device. */
+
+    uint16_t queue_size;        /* Entries in the virtqueue. */
+    struct vring_desc *desc;    /* Descriptor table. */
+    struct vring_avail *avail;  /* Available ring. */
+    volatile struct vring_used *used;   /* Used ring. */
+    uint16_t used_idx;          /* Next used entry to handle. */
+    uint16_t free_head;         /* First free descriptor. */
+    size_t free_cnt;            /* Number of free descriptors. */
+    struct vblk_slot *slots;    /* One per descriptor. */
+
+    struct vblk_xfer *xfers;    /* Dispatches. */
+    size_t xfer_cnt;            /* Number of XFERS. */
+    struct vblk_xfer *current;  /* Dispatch partly sent, if any. */
+  };
+
+static struct vblk vblks[VBLK_MAX];
+static size_t vblk_cnt;
+
+static struct block_operations vblk_operations;
+
+static bool setup_queue (struct vblk *);
+static void interrupt_handler (void *);
+
+/* Finds, initializes, and registers virtio block devices. */
+void
+virtio_blk_init (void)
+{
+  struct pci_dev pci;
+  bool found;
+
+  for (found = pci_find_device (VIRTIO_VENDOR_ID, VIRTIO_BLK_DEVICE_ID,
+                                &pci);
+       found && vblk_cnt < VBLK_MAX; found = pci_find_next (&pci))
+    {
+      struct vblk *d = &vblks[vblk_cnt];
+      char extra_info[32];
+      uint64_t capacity;
+
+      snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) vblk_cnt);
+      if (!(pci_read_config (&pci, PCI_REG_BAR0) & 1))
+        {
+          printf ("%s: no I/O BAR, ignoring\n", d->name);
+          continue;
+        }
+      d->io_base = pci_bar (&pci, 0);
+      pci_enable (&pci, PCI_CMD_IO | PCI_CMD_MASTER);
+
+      /* Reset the device and tell it we drive it, with no
+         optional features. */
+      outb (d->io_base + VIRTIO_REG_STATUS, 0);
+      outb (d->io_base + VIRTIO_REG_STATUS, VIRTIO_STATUS_ACKNOWLEDGE);
+      outb (d->io_base + VIRTIO_REG_STATUS,
+            VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+      outl (d->io_base + VIRTIO_REG_GUEST_FEATURES, 0);
+      if (!setup_queue (d))
+        {
+          printf ("%s: cannot set up virtqueue, ignoring\n", d->name);
+          outb (d->io_base + VIRTIO_REG_STATUS, 0);
+          continue;
+        }
+      outb (d->io_base + VIRTIO_REG_STATUS,
+            (VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER
+             | VIRTIO_STATUS_DRIVER_OK));
+
+      capacity = (inl (d->io_base + VIRTIO_REG_CAPACITY)
+                  | (uint64_t) inl (d->io_base + VIRTIO_REG_CAPACITY + 4) << 32);
+      if (capacity > (block_sector_t) -1)
+        {
+          printf ("%s: using only the first %'"PRDSNu" sectors\n",
+                  d->name, (block_sector_t) -1);
+          capacity = (block_sector_t) -1;
+        }
+
+      pci_register_irq (&pci, interrupt_handler, d, d->name);
+      vblk_cnt++;
+
+      snprintf (extra_info, sizeof extra_info, "virtio, %"PRIu16"-entry queue",
+                d->queue_size);
+      d->block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                                 &vblk_operations, d);
+      partition_scan (d->block);
+    }
+}
+
+/* Allocates and registers D's virtqueue.  Returns false if
+   memory is short or the device has no queue. */
+static bool
+setup_queue (struct vblk *d)
+{
+  size_t avail_ofs, used_ofs, size;
+  uint8_t *ring;
+  uint16_t i;
+
+  outw (d->io_base + VIRTIO_REG_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->io_base + VIRTIO_REG_QUEUE_SIZE);
+  if (d->queue_size == 0)
+    return false;
+
+  /* The legacy layout puts the used ring on the first page
+     boundary after the descriptors and the available ring. */
+  avail_ofs = d->queue_size * sizeof (struct vring_desc);
+  used_ofs = ROUND_UP (avail_ofs + sizeof (struct vring_avail)
+                       + (d->queue_size + 1) * sizeof (uint16_t), PGSIZE);
+  size = used_ofs + sizeof (struct vring_used)
+         + d->queue_size * sizeof (struct vring_used_elem) + sizeof (uint16_t);
+  ring = palloc_get_multiple (PAL_ZERO, DIV_ROUND_UP (size, PGSIZE));
+  d->slots = calloc (d->queue_size, sizeof *d->slots);
+
+  /* Each virtio request takes at least three descriptors, and
+     one more dispatch may be partly sent. */
+  d->xfer_cnt = d->queue_size / 3 + 1;
+  d->xfers = calloc (d->xfer_cnt, sizeof *d->xfers);
+  if (ring == NULL || d->slots == NULL || d->xfers == NULL)
+    {
+      if (ring != NULL)
+        palloc_free_multiple (ring, DIV_ROUND_UP (size, PGSIZE));
+      free (d->slots);
+      free (d->xfers);
+      return false;
+    }
+
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + avail_ofs);
+  d->used = (struct vring_used *) (ring + used_ofs);
+  d->used_idx = 0;
+  for (i = 0; i < d->queue_size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->queue_size;
+  d->current = NULL;
+
+  outl (d->io_base + VIRTIO_REG_QUEUE_PFN, vtop (ring) >> PGBITS);
+  return true;
+}
+
+/* Takes a free descriptor from D and returns its index. */
+static uint16_t
+alloc_desc (struct vblk *d)
+{
+  uint16_t i = d->free_head;
+
+  ASSERT (d->free_cnt > 0);
+  d->free_head = d->desc[i].next;
+  d->free_cnt--;
+  return i;
+}
+
+/* Returns the descriptor chain starting at HEAD to D's free
+   descriptors. */
+static void
+free_chain (struct vblk *d, uint16_t head)
+{
+  for (;;)
+    {
+      struct vring_desc *desc = &d->desc[head];
+      bool more = (desc->flags & VRING_DESC_F_NEXT) != 0;
+      uint16_t next = desc->next;
+
+      desc->next = d->free_head;
+      d->free_head = head;
+      d->free_cnt++;
+      if (!more)
+        break;
+      head = next;
+    }
+}
+
+/* Sends the next sectors of dispatch X to D as one virtio
+   request, with as many sectors as fit in VBLK_MAX_SEGS pieces of
+   memory and the free descriptors.  Returns false, sending
+   nothing, if D has too few free descriptors. */
+static bool
+post_request (struct vblk *d, struct vblk_xfer *x)
+{
+  struct vblk_slot *slot;
+  uint16_t head, last, status;
+  size_t segs = 0;
+
+  if (d->free_cnt < 3)
+    return false;
+
+  /* Header. */
+  head = last = alloc_desc (d);
+  slot = &d->slots[head];
+  slot->header.type = x->write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  slot->header.reserved = 0;
+  slot->header.sector = x->sector;
+  slot->status = 0xff;
+  slot->xfer = x;
+  d->desc[head].addr = vtop (&slot->header);
+  d->desc[head].len = sizeof slot->header;
+  d->desc[head].flags = VRING_DESC_F_NEXT;
+
+  /* Data, extending the last piece when the next sector follows
+     it in physical memory, and keeping a descriptor for the
+     status. */
+  while (x->left > 0)
+    {
+      struct block_cursor save = x->cursor;
+      uintptr_t addr = vtop (block_cursor_next (&x->cursor));
+      struct vring_desc *prev = &d->desc[last];
+
+      if (segs > 0 && prev->addr + prev->len == addr)
+        prev->len += BLOCK_SECTOR_SIZE;
+      else if (segs < VBLK_MAX_SEGS && d->free_cnt > 1)
+        {
+          uint16_t i = alloc_desc (d);
+          prev->next = i;
+          d->desc[i].addr = addr;
+          d->desc[i].len = BLOCK_SECTOR_SIZE;
+          d->desc[i].flags = (VRING_DESC_F_NEXT
+                              | (x->write ? 0 : VRING_DESC_F_WRITE));
+          last = i;
+          segs++;
+        }
+      else
+        {
+          x->cursor = save;
+          break;
+        }
+      x->sector++;
+      x->left--;
+    }
+
+  /* Status. */
+  status = alloc_desc (d);
+  d->desc[last].next = status;
+  d->desc[status].addr = vtop (&slot->status);
+  d->desc[status].len = sizeof slot->status;
+  d->desc[status].flags = VRING_DESC_F_WRITE;
+
+  /* Make the chain available.  The device must see the ring
+     entry before the new index. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+  x->outstanding++;
+  return true;
+}
+
+/* Returns a free dispatch of D, or a null pointer if all are in
+   use. */
+static struct vblk_xfer *
+find_free_xfer (struct vblk *d)
+{
+  size_t i;
+
+  for (i = 0; i < d->xfer_cnt; i++)
+    if (d->xfers[i].requests == NULL)
+      return &d->xfers[i];
+  return NULL;
+}
+
+/* Sends D as many of its queued requests as its virtqueue has
+   room for, and tells it to look if there are any.  Called by
+   the block layer with interrupts off, and by the interrupt
+   handler once requests are used. */
+static void
+vblk_start (void *d_)
+{
+  struct vblk *d = d_;
+  bool posted = false;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (;;)
+    {
+      struct vblk_xfer *x = d->current;
+
+      if (x == NULL)
+        {
+          struct block_request *r;
+
+          x = find_free_xfer (d);
+          if (x == NULL || (r = block_dequeue (d->block)) == NULL)
+            break;
+          x->requests = r;
+          x->write = r->write;
+          x->sector = r->sector;
+          for (x->left = 0; r != NULL; r = r->next)
+            x->left += r->cnt;
+          block_cursor_init (&x->cursor, x->requests);
+          x->outstanding = 0;
+          d->current = x;
+        }
+
+      if (!post_request (d, x))
+        break;
+      posted = true;
+      if (x->left == 0)
+        d->current = NULL;
+    }
+
+  barrier ();
+  if (posted)
+    outw (d->io_base + VIRTIO_REG_QUEUE_NOTIFY, 0);
+}
+
+static struct block_operations vblk_operations =
+  {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    vblk_start,
+    NULL
+  };
+
+/* Handles the requests that device D has used: frees their
+   descriptors, completes the dispatches that are done, and sends
+   more requests. */
+static void
+handle_used (struct vblk *d)
+{
+  while (d->used_idx != d->used->idx)
+    {
+      const volatile struct vring_used_elem *e;
+      struct vblk_slot *slot;
+      struct vblk_xfer *x;
+
+      /* Read the entry only after seeing the index. */
+      barrier ();
+      e = &d->used->ring[d->used_idx % d->queue_size];
+      slot = &d->slots[e->id];
+      x = slot->xfer;
+      if (slot->status != VIRTIO_BLK_S_OK)
+        PANIC ("%s: disk %s failed, sector=%"PRDSNu,
+               d->name, x->write ? "write" : "read",
+               (block_sector_t) slot->header.sector);
+      free_chain (d, e->id);
+      d->used_idx++;
+
+      if (--x->outstanding == 0 && x->left == 0)
+        {
+          struct block_request *requests = x->requests;
+          x->requests = NULL;
+          block_complete (d->block, requests);
+        }
+    }
+  vblk_start (d);
+}
+
+/* Virtio block interrupt handler for device D_. */
+static void
+interrupt_handler (void *d_)
+{
+  struct vblk *d = d_;
+
+  /* Reading the ISR acknowledges the interrupt. */
+  if (inb (d->io_base + VIRTIO_REG_ISR) & VIRTIO_ISR_QUEUE)
+    handle_used (d);
+}
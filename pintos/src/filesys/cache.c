@@ -0,0 +1,535 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   Holds a fixed number of file system sectors in memory.  Writes
+   only mark a cached sector dirty; dirty sectors reach the disk
+   when they are evicted or when cache_flush() is called, which
+   the file system does periodically and at shutdown.  Eviction
+   uses the clock algorithm over the array of entries.
+   cache_flush() submits its writes in batches, so that the disk
+   queue can sort and merge them.
+
+   Read-ahead: cache_prefetch() queues runs of sectors that are
+   likely to be read soon, and the read-ahead thread reads them
+   into the cache in the background, so that a process streaming
+   through a file finds its next sectors already in memory.  The
+   queue is small and requests that do not fit are dropped, since
+   read-ahead is only a hint.
+
+   Synchronization: cache_lock protects the sector-to-entry map,
+   every entry's SECTOR, VALID, PIN_CNT and ACCESSED members, and
+   the clock hand.  An entry's own lock protects its DATA and
+   DIRTY members, and may only be acquired by a thread that has
+   pinned the entry.  An entry with a nonzero PIN_CNT is never
+   evicted.  A thread may hold an entry's lock while acquiring
+   cache_lock only if the entry is pinned, as cache_flush() and
+   cache_load() do to keep a batch of entries locked across
+   their loops; in turn, nobody waits for a pinned entry's lock
+   while holding cache_lock.  Together these rule out deadlock
+   between the two kinds of lock. */
+
+/* A cached sector. */
+struct cache_entry
+{
+    struct hash_elem elem;              /* Element in cache_map. */
+    block_sector_t sector;              /* Cached sector. */
+    bool valid;                         /* Does SECTOR mean anything? */
+    bool dirty;                         /* Modified since last written? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int pin_cnt;                        /* Users that prevent eviction. */
+    struct lock lock;                   /* Protects DATA and DIRTY. */
+    uint8_t *data;                      /* BLOCK_SECTOR_SIZE bytes. */
+};
+
+/* Number of entries in the cache, settable with -fs-cache. */
+static size_t cache_sector_cnt = CACHE_DEFAULT_SECTORS;
+
+static struct cache_entry *cache;       /* Array of entries. */
+static struct hash cache_map;           /* Valid entries by sector. */
+static struct lock cache_lock;          /* See comment at top. */
+static size_t clock_hand;               /* Next eviction candidate. */
+
+/* Most dirty sectors cache_flush() has in flight at once. */
+#define CACHE_FLUSH_BATCH 16
+
+/* Most sectors cache_load() reads in one request. */
+#define CACHE_LOAD_MAX 16
+
+/* Runs of sectors waiting to be read ahead. */
+#define CACHE_PREFETCH_MAX 32
+struct prefetch_run
+{
+    block_sector_t start;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+};
+static struct prefetch_run prefetch_queue[CACHE_PREFETCH_MAX];
+static size_t prefetch_head;            /* Oldest run in the queue. */
+static size_t prefetch_cnt;             /* Runs in the queue. */
+static struct lock prefetch_lock;       /* Protects the queue. */
+static struct condition prefetch_cond;  /* Signaled when a run is queued. */
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static thread_func cache_readahead;
+
+/* Sets the number of sectors that cache_init() will allocate.
+   Must be called before cache_init(). */
+void
+cache_configure (size_t sector_cnt)
+{
+    if (sector_cnt > 0)
+        cache_sector_cnt = sector_cnt;
+}
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+    const size_t per_page = PGSIZE / BLOCK_SECTOR_SIZE;
+    uint8_t *page = NULL;
+    size_t i;
+
+    cache = calloc (cache_sector_cnt, sizeof *cache);
+    if (cache == NULL)
+        PANIC ("buffer cache allocation failed");
+
+    for (i = 0; i < cache_sector_cnt; i++)
+    {
+        struct cache_entry *e = &cache[i];
+        if (i % per_page == 0)
+            page = palloc_get_page (PAL_ASSERT);
+        e->data = page + (i % per_page) * BLOCK_SECTOR_SIZE;
+        e->valid = false;
+        e->dirty = false;
+        e->accessed = false;
+        e->pin_cnt = 0;
+        lock_init (&e->lock);
+    }
+
+    hash_init (&cache_map, cache_hash, cache_less, NULL);
+    lock_init (&cache_lock);
+    clock_hand = 0;
+
+    prefetch_head = prefetch_cnt = 0;
+    lock_init (&prefetch_lock);
+    cond_init (&prefetch_cond);
+    thread_create ("fs-readahead", PRI_DEFAULT, cache_readahead, NULL);
+}
+
+/* Writes every dirty sector back to disk.  Called on file system
+   shutdown. */
+void
+cache_done (void)
+{
+    cache_flush ();
+}
+
+/* Returns the valid entry caching SECTOR, or a null pointer if
+   there is none.  The caller must hold cache_lock. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+    struct cache_entry key;
+    struct hash_elem *e;
+
+    key.sector = sector;
+    e = hash_find (&cache_map, &key.elem);
+    return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Picks an unpinned entry with the clock algorithm, writes it
+   back if it is dirty, and returns it, now invalid.  Returns a
+   null pointer if every entry is pinned.  The caller must hold
+   cache_lock.
+
+   A dirty victim is written back with cache_lock released, so
+   that other cache users, hits included, are not held up by the
+   disk, and is only taken if it is still unused afterward.  The
+   caller must therefore look SECTOR up again after this returns,
+   since another thread may have cached it meanwhile. */
+static struct cache_entry *
+cache_evict (void)
+{
+    size_t scanned;
+
+    for (scanned = 0; scanned < 2 * cache_sector_cnt; scanned++)
+    {
+        struct cache_entry *e = &cache[clock_hand];
+        clock_hand = (clock_hand + 1) % cache_sector_cnt;
+
+        if (e->pin_cnt > 0)
+            continue;
+        if (e->valid && e->accessed)
+        {
+            e->accessed = false;
+            continue;
+        }
+
+        if (e->valid && e->dirty)
+        {
+            /* Pinning E keeps it cached, and in place, while it
+               is written. */
+            e->pin_cnt++;
+            lock_release (&cache_lock);
+            lock_acquire (&e->lock);
+            if (e->dirty)
+            {
+                block_write (fs_device, e->sector, e->data);
+                e->dirty = false;
+            }
+            lock_release (&e->lock);
+            lock_acquire (&cache_lock);
+            e->pin_cnt--;
+            if (e->pin_cnt > 0 || e->accessed || e->dirty)
+                continue;
+        }
+
+        if (e->valid)
+        {
+            hash_delete (&cache_map, &e->elem);
+            e->valid = false;
+        }
+        return e;
+    }
+    return NULL;
+}
+
+/* Makes E, just obtained from cache_evict(), the entry for
+   SECTOR, pinned and with its lock held.  The caller must hold
+   cache_lock. */
+static void
+cache_install (struct cache_entry *e, block_sector_t sector)
+{
+    e->sector = sector;
+    e->valid = true;
+    e->accessed = true;
+    e->pin_cnt = 1;
+    hash_insert (&cache_map, &e->elem);
+
+    /* Nobody else can hold the lock of an unpinned entry, so this
+       does not block.  Later users of SECTOR wait on it until the
+       entry's data is in place. */
+    lock_acquire (&e->lock);
+}
+
+/* Returns the entry caching SECTOR, pinned and with its lock
+   held.  If the sector is not yet cached, it is read from disk
+   if READ is true; otherwise the caller must overwrite the
+   entire sector before releasing the entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+    struct cache_entry *e;
+
+    for (;;)
+    {
+        lock_acquire (&cache_lock);
+        e = cache_lookup (sector);
+        if (e != NULL)
+        {
+            e->pin_cnt++;
+            e->accessed = true;
+            lock_release (&cache_lock);
+            lock_acquire (&e->lock);
+            return e;
+        }
+
+        e = cache_evict ();
+        if (e != NULL)
+        {
+            if (cache_lookup (sector) == NULL)
+                break;
+
+            /* SECTOR was cached while the victim was written
+               back.  The victim is left free. */
+            lock_release (&cache_lock);
+            continue;
+        }
+
+        /* Every entry is in use.  Let their users finish. */
+        lock_release (&cache_lock);
+        thread_yield ();
+    }
+
+    cache_install (e, sector);
+    lock_release (&cache_lock);
+
+    if (read)
+        block_read (fs_device, sector, e->data);
+    return e;
+}
+
+/* Releases entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+    lock_release (&e->lock);
+    lock_acquire (&cache_lock);
+    e->pin_cnt--;
+    lock_release (&cache_lock);
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+    cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to SECTOR. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+    cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+    struct cache_entry *e;
+
+    ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+    e = cache_get (sector, true);
+    memcpy (buffer, e->data + ofs, size);
+    cache_put (e);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at byte
+   OFS within the sector.  The sector is only read from disk
+   first if the write does not cover all of it. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+    struct cache_entry *e;
+
+    ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+    e = cache_get (sector, ofs != 0 || size != BLOCK_SECTOR_SIZE);
+    memcpy (e->data + ofs, buffer, size);
+    e->dirty = true;
+    cache_put (e);
+}
+
+/* Completion function for cache_flush()'s writes. */
+static void
+flush_done (struct block_request *r UNUSED, void *done)
+{
+    sema_up (done);
+}
+
+/* Waits for the N writes of BATCH, submitted by cache_flush(),
+   and releases their entries, now clean. */
+static void
+flush_wait (struct cache_entry **batch, size_t n, struct semaphore *done)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        sema_down (done);
+    for (i = 0; i < n; i++)
+    {
+        batch[i]->dirty = false;
+        cache_put (batch[i]);
+    }
+}
+
+/* Writes every dirty sector in the cache back to disk. */
+void
+cache_flush (void)
+{
+    struct cache_entry *batch[CACHE_FLUSH_BATCH];
+    struct block_request req[CACHE_FLUSH_BATCH];
+    struct block_iovec iov[CACHE_FLUSH_BATCH];
+    struct semaphore done;
+    size_t i, n = 0;
+
+    sema_init (&done, 0);
+    for (i = 0; i < cache_sector_cnt; i++)
+    {
+        struct cache_entry *e = &cache[i];
+
+        lock_acquire (&cache_lock);
+        if (!e->valid || !e->dirty)
+        {
+            lock_release (&cache_lock);
+            continue;
+        }
+        e->pin_cnt++;
+        lock_release (&cache_lock);
+
+        lock_acquire (&e->lock);
+        if (!e->dirty)
+        {
+            cache_put (e);
+            continue;
+        }
+
+        /* Keep E locked until its write is done. */
+        iov[n].base = e->data;
+        iov[n].cnt = 1;
+        block_request_init (&req[n], e->sector, true, &iov[n], 1,
+                            flush_done, &done);
+        block_submit (fs_device, &req[n]);
+        batch[n++] = e;
+        if (n == CACHE_FLUSH_BATCH)
+        {
+            flush_wait (batch, n, &done);
+            n = 0;
+        }
+    }
+    flush_wait (batch, n, &done);
+}
+
+/* Returns a new entry for SECTOR, pinned and with its lock held
+   but not yet holding its data, or a null pointer if SECTOR is
+   already cached or every entry is in use. */
+static struct cache_entry *
+cache_claim (block_sector_t sector)
+{
+    struct cache_entry *e = NULL;
+
+    lock_acquire (&cache_lock);
+    if (cache_lookup (sector) == NULL)
+    {
+        e = cache_evict ();
+        if (e != NULL && cache_lookup (sector) == NULL)
+            cache_install (e, sector);
+        else
+            e = NULL;
+    }
+    lock_release (&cache_lock);
+    return e;
+}
+
+/* Reads the N entries in RUN, which cache consecutive sectors,
+   from disk with one request and releases them. */
+static void
+cache_fill (struct cache_entry **run, size_t n)
+{
+    struct block_iovec iov[CACHE_LOAD_MAX];
+    size_t i;
+
+    ASSERT (n > 0 && n <= CACHE_LOAD_MAX);
+    for (i = 0; i < n; i++)
+    {
+        iov[i].base = run[i]->data;
+        iov[i].cnt = 1;
+    }
+    block_read_multi (fs_device, run[0]->sector, iov, n);
+    for (i = 0; i < n; i++)
+        cache_put (run[i]);
+}
+
+/* Returns the number of sectors that cache_load() reads with one
+   request, which is also the most that it keeps pinned.  This is
+   never more than a quarter of the cache. */
+size_t
+cache_load_limit (void)
+{
+    size_t run_max = cache_sector_cnt / 4;
+
+    if (run_max > CACHE_LOAD_MAX)
+        run_max = CACHE_LOAD_MAX;
+    if (run_max == 0)
+        run_max = 1;
+    return run_max;
+}
+
+/* Brings the CNT sectors starting at SECTOR into the cache.
+   Sectors already cached are left alone; each run of missing
+   ones is read with a single device request. */
+void
+cache_load (block_sector_t sector, size_t cnt)
+{
+    struct cache_entry *run[CACHE_LOAD_MAX];
+    size_t run_max = cache_load_limit ();
+    size_t n, i;
+
+    for (i = n = 0; i < cnt; i++)
+    {
+        struct cache_entry *e = cache_claim (sector + i);
+        if (e != NULL)
+        {
+            run[n++] = e;
+            if (n < run_max)
+                continue;
+        }
+        if (n > 0)
+            cache_fill (run, n);
+        n = 0;
+    }
+    if (n > 0)
+        cache_fill (run, n);
+}
+
+/* Asks for the CNT sectors starting at SECTOR to be read into
+   the cache in the background.  Returns without waiting. */
+void
+cache_prefetch (block_sector_t sector, size_t cnt)
+{
+    if (cnt == 0)
+        return;
+
+    lock_acquire (&prefetch_lock);
+    if (prefetch_cnt < CACHE_PREFETCH_MAX)
+    {
+        size_t tail = (prefetch_head + prefetch_cnt) % CACHE_PREFETCH_MAX;
+        struct prefetch_run *r = &prefetch_queue[tail];
+
+        r->start = sector;
+        r->cnt = cnt;
+        prefetch_cnt++;
+        cond_signal (&prefetch_cond, &prefetch_lock);
+    }
+    lock_release (&prefetch_lock);
+}
+
+/* Read-ahead thread: reads queued runs into the cache. */
+static void
+cache_readahead (void *aux UNUSED)
+{
+    for (;;)
+    {
+        struct prefetch_run r;
+
+        lock_acquire (&prefetch_lock);
+        while (prefetch_cnt == 0)
+            cond_wait (&prefetch_cond, &prefetch_lock);
+        r = prefetch_queue[prefetch_head];
+        prefetch_head = (prefetch_head + 1) % CACHE_PREFETCH_MAX;
+        prefetch_cnt--;
+        lock_release (&prefetch_lock);
+
+        cache_load (r.start, r.cnt);
+    }
+}
+
+/* Hash function for cache_map. */
+static unsigned
+cache_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int (hash_entry (e, struct cache_entry, elem)->sector);
+}
+
+/* Comparison function for cache_map. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+    return (hash_entry (a, struct cache_entry, elem)->sector
+            < hash_entry (b, struct cache_entry, elem)->sector);
+}
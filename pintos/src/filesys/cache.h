@@ -0,0 +1,23 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Default number of sectors held by the buffer cache. */
+#define CACHE_DEFAULT_SECTORS 64
+
+void cache_configure (size_t sector_cnt);
+void cache_init (void);
+void cache_done (void);
+void cache_flush (void);
+
+void cache_read (block_sector_t, void *);
+void cache_write (block_sector_t, const void *);
+void cache_read_at (block_sector_t, void *, int ofs, int size);
+void cache_write_at (block_sector_t, const void *, int ofs, int size);
+size_t cache_load_limit (void);
+void cache_load (block_sector_t, size_t cnt);
+void cache_prefetch (block_sector_t, size_t cnt);
+
+#endif /* filesys/cache.h */
@@ -0,0 +1,178 @@
+#include "filesys/dcache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+
+/* Directory entry cache.
+
+   Remembers the result of looking up a name in a directory,
+   keyed by the directory's inode sector and the name, so that
+   repeated lookups of the same name do not read the directory.
+   A name found absent is remembered too, as a negative entry
+   whose inode sector is DCACHE_NEGATIVE.  The directory code
+   keeps the cache exact by recording every name it adds or
+   removes, and when an inode is freed its names are forgotten,
+   in case it was a directory and its sector is reused.  When all
+   DCACHE_SIZE entries are in use, the least recently used one is
+   replaced. */
+
+/* A cached name. */
+struct dcache_entry
+{
+    struct hash_elem hash_elem;         /* Element in dcache_map. */
+    struct list_elem lru_elem;          /* Element in dcache_lru. */
+    block_sector_t dir_sector;          /* Directory's inode sector, or
+                                           DCACHE_NEGATIVE if unused. */
+    block_sector_t inode_sector;        /* Named inode, or DCACHE_NEGATIVE. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+};
+
+static struct dcache_entry *dcache;     /* Array of DCACHE_SIZE entries. */
+static size_t dcache_used;              /* Entries handed out so far. */
+static struct hash dcache_map;          /* Entries by directory and name. */
+static struct list dcache_lru;          /* Most recently used first. */
+static struct lock dcache_lock;         /* Protects all of the above. */
+
+static hash_hash_func dcache_hash;
+static hash_less_func dcache_less;
+
+/* Initializes the directory entry cache. */
+void
+dcache_init (void)
+{
+    dcache = calloc (DCACHE_SIZE, sizeof *dcache);
+    if (dcache == NULL)
+        PANIC ("directory entry cache allocation failed");
+    dcache_used = 0;
+    hash_init (&dcache_map, dcache_hash, dcache_less, NULL);
+    list_init (&dcache_lru);
+    lock_init (&dcache_lock);
+}
+
+/* Returns the entry for NAME in the directory at DIR_SECTOR, or
+   a null pointer if there is none.  The caller must hold
+   dcache_lock. */
+static struct dcache_entry *
+dcache_find (block_sector_t dir_sector, const char *name)
+{
+    struct dcache_entry key;
+    struct hash_elem *e;
+
+    key.dir_sector = dir_sector;
+    strlcpy (key.name, name, sizeof key.name);
+    e = hash_find (&dcache_map, &key.hash_elem);
+    return e != NULL ? hash_entry (e, struct dcache_entry, hash_elem) : NULL;
+}
+
+/* Looks up NAME in the directory whose inode is at DIR_SECTOR.
+   Returns false if the cache does not know.  Otherwise, returns
+   true and stores the named inode's sector in *INODE_SECTOR, or
+   DCACHE_NEGATIVE if the directory has no such name. */
+bool
+dcache_lookup (block_sector_t dir_sector, const char *name,
+               block_sector_t *inode_sector)
+{
+    struct dcache_entry *e;
+
+    if (strlen (name) > NAME_MAX)
+        return false;
+
+    lock_acquire (&dcache_lock);
+    e = dcache_find (dir_sector, name);
+    if (e != NULL)
+    {
+        *inode_sector = e->inode_sector;
+        list_remove (&e->lru_elem);
+        list_push_front (&dcache_lru, &e->lru_elem);
+    }
+    lock_release (&dcache_lock);
+
+    return e != NULL;
+}
+
+/* Records that NAME in the directory whose inode is at
+   DIR_SECTOR refers to INODE_SECTOR, or to nothing if
+   INODE_SECTOR is DCACHE_NEGATIVE. */
+void
+dcache_insert (block_sector_t dir_sector, const char *name,
+               block_sector_t inode_sector)
+{
+    struct dcache_entry *e;
+
+    if (strlen (name) > NAME_MAX)
+        return;
+
+    lock_acquire (&dcache_lock);
+    e = dcache_find (dir_sector, name);
+    if (e != NULL)
+        list_remove (&e->lru_elem);
+    else
+    {
+        if (dcache_used < DCACHE_SIZE)
+            e = &dcache[dcache_used++];
+        else
+        {
+            e = list_entry (list_pop_back (&dcache_lru),
+                            struct dcache_entry, lru_elem);
+            if (e->dir_sector != DCACHE_NEGATIVE)
+                hash_delete (&dcache_map, &e->hash_elem);
+        }
+        e->dir_sector = dir_sector;
+        strlcpy (e->name, name, sizeof e->name);
+        hash_insert (&dcache_map, &e->hash_elem);
+    }
+    e->inode_sector = inode_sector;
+    list_push_front (&dcache_lru, &e->lru_elem);
+    lock_release (&dcache_lock);
+}
+
+/* Forgets every name cached for the directory whose inode is at
+   DIR_SECTOR, which is being freed, so that whatever is created
+   at that sector next does not inherit them.  The forgotten
+   entries are replaced first.  This scans the whole cache, which
+   is cheap next to the disk writes that freeing an inode takes. */
+void
+dcache_invalidate_dir (block_sector_t dir_sector)
+{
+    size_t i;
+
+    lock_acquire (&dcache_lock);
+    for (i = 0; i < dcache_used; i++)
+    {
+        struct dcache_entry *e = &dcache[i];
+        if (e->dir_sector == dir_sector)
+        {
+            hash_delete (&dcache_map, &e->hash_elem);
+            e->dir_sector = DCACHE_NEGATIVE;
+            list_remove (&e->lru_elem);
+            list_push_back (&dcache_lru, &e->lru_elem);
+        }
+    }
+    lock_release (&dcache_lock);
+}
+
+/* Hash function for dcache_map. */
+static unsigned
+dcache_hash (const struct hash_elem *e_, void *aux UNUSED)
+{
+    const struct dcache_entry *e = hash_entry (e_, struct dcache_entry,
+                                               hash_elem);
+    return hash_string (e->name) ^ hash_int (e->dir_sector);
+}
+
+/* Comparison function for dcache_map. */
+static bool
+dcache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+             void *aux UNUSED)
+{
+    const struct dcache_entry *a = hash_entry (a_, struct dcache_entry,
+                                               hash_elem);
+    const struct dcache_entry *b = hash_entry (b_, struct dcache_entry,
+                                               hash_elem);
+    if (a->dir_sector != b->dir_sector)
+        return a->dir_sector < b->dir_sector;
+    return strcmp (a->name, b->name) < 0;
+}
@@ -1,7 +1,11 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
+#include <round.h>
+#include <stddef.h>
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -21,6 +25,69 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
 };
 
+/* Directory formats.
+
+   A small directory is an array of struct dir_entry that is
+   searched linearly.  Once it needs more than DIR_LINEAR_MAX
+   entries it is rewritten in a hashed format: a header block
+   followed by BUCKET_CNT bucket blocks, each an array of entries
+   that chains to overflow blocks appended to the file as needed.
+   An entry lives in the chain of bucket hash_string(NAME) %
+   BUCKET_CNT, and the table doubles once it is 3/4 full, so a
+   lookup or insertion reads the header and, almost always, one
+   bucket block, however large the directory grows. */
+
+/* Marks a hashed directory.  It occupies the place of the first
+   entry's inode sector in a linear directory, which can never
+   hold this value. */
+#define DIR_HASHED ((block_sector_t) -1)
+
+/* Most entries kept in a linear directory: one sector's worth. */
+#define DIR_LINEAR_MAX (BLOCK_SECTOR_SIZE / sizeof (struct dir_entry))
+
+/* Entries per bucket block. */
+#define DIR_BUCKET_ENTRIES 25
+
+/* Buckets in a newly hashed directory. */
+#define DIR_MIN_BUCKETS 8
+
+/* Header of a hashed directory, in block 0 of the file. */
+struct dir_header
+{
+    block_sector_t marker;              /* DIR_HASHED. */
+    uint32_t bucket_cnt;                /* Buckets, in blocks 1...bucket_cnt. */
+    uint32_t entry_cnt;                 /* Entries in use. */
+    uint32_t block_cnt;                 /* Blocks in use, including this one. */
+};
+
+/* A bucket or overflow block of a hashed directory. */
+struct dir_bucket
+{
+    struct dir_entry entries[DIR_BUCKET_ENTRIES];
+    uint32_t next;                      /* Next block in chain, or 0. */
+};
+
+/* Byte offset of block BLOCK of a hashed directory. */
+static inline off_t
+block_ofs (uint32_t block)
+{
+    return (off_t) block * BLOCK_SECTOR_SIZE;
+}
+
+/* Byte offset of entry SLOT in block BLOCK of a hashed directory. */
+static inline off_t
+slot_ofs (uint32_t block, size_t slot)
+{
+    return block_ofs (block) + slot * sizeof (struct dir_entry);
+}
+
+/* Returns the first block of the bucket chain for NAME. */
+static inline uint32_t
+bucket_of (const struct dir_header *h, const char *name)
+{
+    return 1 + hash_string (name) % h->bucket_cnt;
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -83,6 +150,55 @@ dir_get_inode (struct dir *dir)
     return dir->inode;
 }
 
+/* Reads DIR's header into *H and returns true if DIR is hashed.
+   Returns false for a linear directory. */
+static bool
+read_header (const struct dir *dir, struct dir_header *h)
+{
+    return (inode_read_at (dir->inode, h, sizeof *h, 0) == sizeof *h
+            && h->marker == DIR_HASHED);
+}
+
+/* Writes *H as DIR's header. */
+static bool
+write_header (struct dir *dir, const struct dir_header *h)
+{
+    return inode_write_at (dir->inode, h, sizeof *h, 0) == sizeof *h;
+}
+
+/* Reads block BLOCK of hashed directory DIR into *B. */
+static bool
+read_bucket (const struct dir *dir, uint32_t block, struct dir_bucket *b)
+{
+    return (inode_read_at (dir->inode, b, sizeof *b, block_ofs (block))
+            == sizeof *b);
+}
+
+/* Reads the entry slot at or after *POS in DIR into *E, in use
+   or not, and advances *POS past it.  Returns false at the end
+   of the directory. */
+static bool
+read_slot (const struct dir *dir, off_t *pos, struct dir_entry *e)
+{
+    struct dir_header h;
+
+    if (read_header (dir, &h))
+    {
+        /* Skip the header and the tail of each block. */
+        if (*pos < BLOCK_SECTOR_SIZE)
+            *pos = BLOCK_SECTOR_SIZE;
+        if (*pos % BLOCK_SECTOR_SIZE / sizeof *e >= DIR_BUCKET_ENTRIES)
+            *pos = ROUND_UP (*pos, BLOCK_SECTOR_SIZE);
+        if ((uint32_t) (*pos / BLOCK_SECTOR_SIZE) >= h.block_cnt)
+            return false;
+    }
+
+    if (inode_read_at (dir->inode, e, sizeof *e, *pos) != sizeof *e)
+        return false;
+    *pos += sizeof *e;
+    return true;
+}
+
 /* Searches DIR for a file with the given NAME.
    If successful, returns true, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
@@ -92,12 +208,42 @@ static bool
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp)
 {
+    struct dir_header h;
     struct dir_entry e;
     size_t ofs;
 
     ASSERT (dir != NULL);
     ASSERT (name != NULL);
 
+    if (read_header (dir, &h))
+    {
+        /* Hashed: search NAME's bucket chain. */
+        struct dir_bucket *b = malloc (sizeof *b);
+        uint32_t block;
+        bool found = false;
+
+        if (b == NULL)
+            return false;
+        for (block = bucket_of (&h, name);
+             block != 0 && !found && read_bucket (dir, block, b);
+             block = b->next)
+        {
+            size_t i;
+            for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+                if (b->entries[i].in_use && !strcmp (name, b->entries[i].name))
+                {
+                    if (ep != NULL)
+                        *ep = b->entries[i];
+                    if (ofsp != NULL)
+                        *ofsp = slot_ofs (block, i);
+                    found = true;
+                    break;
+                }
+        }
+        free (b);
+        return found;
+    }
+
     for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
          ofs += sizeof e)
         if (e.in_use && !strcmp (name, e.name))
@@ -119,19 +265,195 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode)
 {
+    block_sector_t dir_sector, sector;
     struct dir_entry e;
 
     ASSERT (dir != NULL);
     ASSERT (name != NULL);
 
-    if (lookup (dir, name, &e, NULL))
-        *inode = inode_open (e.inode_sector);
+    /* Only read the directory if the name is not cached.  DIR
+       stays locked until the inode is open, so that the cache
+       cannot be filled in from a stale read, and a concurrent
+       dir_remove() and close cannot free the inode's sector and
+       let it be reused in between. */
+    dir_sector = inode_get_inumber (dir->inode);
+    inode_lock_dir (dir->inode);
+    if (!dcache_lookup (dir_sector, name, &sector))
+    {
+        if (lookup (dir, name, &e, NULL))
+            sector = e.inode_sector;
+        else
+            sector = DCACHE_NEGATIVE;
+        dcache_insert (dir_sector, name, sector);
+    }
+
+    if (sector != DCACHE_NEGATIVE)
+        *inode = inode_open (sector);
     else
         *inode = NULL;
+    inode_unlock_dir (dir->inode);
 
     return *inode != NULL;
 }
 
+/* Stores E in hashed directory DIR, whose header is *H, without
+   checking whether the table is too full.  Updates *H but does
+   not write it. */
+static bool
+hashed_insert (struct dir *dir, struct dir_header *h,
+               const struct dir_entry *e)
+{
+    struct dir_bucket *b = malloc (sizeof *b);
+    uint32_t block = bucket_of (h, e->name);
+    bool success = false;
+
+    if (b == NULL)
+        return false;
+    while (read_bucket (dir, block, b))
+    {
+        size_t i;
+
+        for (i = 0; i < DIR_BUCKET_ENTRIES; i++)
+            if (!b->entries[i].in_use)
+                break;
+        if (i < DIR_BUCKET_ENTRIES)
+        {
+            success = (inode_write_at (dir->inode, e, sizeof *e,
+                                       slot_ofs (block, i)) == sizeof *e);
+            break;
+        }
+
+        if (b->next == 0)
+        {
+            /* Chain is full: append an empty overflow block. */
+            uint32_t new_block = h->block_cnt;
+            memset (b, 0, sizeof *b);
+            if (inode_write_at (dir->inode, b, sizeof *b, block_ofs (new_block))
+                != sizeof *b)
+                break;
+            h->block_cnt++;
+            if (inode_write_at (dir->inode, &new_block, sizeof new_block,
+                                block_ofs (block)
+                                + offsetof (struct dir_bucket, next))
+                != sizeof new_block)
+                break;
+            block = new_block;
+        }
+        else
+            block = b->next;
+    }
+    free (b);
+
+    if (success)
+        h->entry_cnt++;
+    return success;
+}
+
+/* Reads every entry in use in DIR into a newly allocated array,
+   stored in *ENTRIES, with room for one more.  Stores the number
+   read in *CNT.  Returns false if memory runs out. */
+static bool
+collect_entries (const struct dir *dir, struct dir_entry **entries,
+                 size_t *cnt)
+{
+    size_t max = inode_length (dir->inode) / sizeof (struct dir_entry) + 1;
+    struct dir_entry e;
+    off_t pos = 0;
+
+    *entries = malloc (max * sizeof **entries);
+    if (*entries == NULL)
+        return false;
+    *cnt = 0;
+    while (read_slot (dir, &pos, &e))
+        if (e.in_use && *cnt < max - 1)
+            (*entries)[(*cnt)++] = e;
+    return true;
+}
+
+/* Rewrites DIR in hashed format with BUCKET_CNT buckets, holding
+   the CNT entries in ENTRIES.  Every entry's place, and so the
+   number of overflow blocks each chain needs, is worked out
+   first, and the file is grown to its new size before anything
+   is overwritten, so that running out of memory or disk space
+   leaves DIR intact.  Each block is then written whole, and the
+   header last. */
+static bool
+rebuild (struct dir *dir, const struct dir_entry *entries, size_t cnt,
+         uint32_t bucket_cnt)
+{
+    uint32_t *bucket = malloc (cnt * sizeof *bucket);
+    uint32_t *chain_len = calloc (bucket_cnt, sizeof *chain_len);
+    struct dir_bucket *b = malloc (sizeof *b);
+    struct dir_header h;
+    uint32_t k, next;
+    size_t i;
+    bool success = false;
+
+    if (bucket == NULL || chain_len == NULL || b == NULL)
+        goto done;
+
+    /* Lay out the chains. */
+    h.marker = DIR_HASHED;
+    h.bucket_cnt = bucket_cnt;
+    h.entry_cnt = cnt;
+    h.block_cnt = bucket_cnt + 1;
+    for (i = 0; i < cnt; i++)
+    {
+        bucket[i] = bucket_of (&h, entries[i].name);
+        chain_len[bucket[i] - 1]++;
+    }
+    for (k = 0; k < bucket_cnt; k++)
+        if (chain_len[k] > DIR_BUCKET_ENTRIES)
+            h.block_cnt += DIV_ROUND_UP (chain_len[k], DIR_BUCKET_ENTRIES) - 1;
+
+    /* Grow the file by writing its last byte, which lies past
+       the old end of file. */
+    if (inode_length (dir->inode) < block_ofs (h.block_cnt))
+    {
+        char zero = 0;
+        if (inode_write_at (dir->inode, &zero, 1, block_ofs (h.block_cnt) - 1)
+            != 1)
+            goto done;
+    }
+
+    /* Write each chain, overflow blocks following the buckets. */
+    next = bucket_cnt + 1;
+    for (k = 1; k <= bucket_cnt; k++)
+    {
+        uint32_t block = k;
+        size_t slot = 0;
+
+        memset (b, 0, sizeof *b);
+        for (i = 0; i < cnt; i++)
+        {
+            if (bucket[i] != k)
+                continue;
+            if (slot == DIR_BUCKET_ENTRIES)
+            {
+                b->next = next;
+                if (inode_write_at (dir->inode, b, sizeof *b, block_ofs (block))
+                    != sizeof *b)
+                    goto done;
+                block = next++;
+                memset (b, 0, sizeof *b);
+                slot = 0;
+            }
+            b->entries[slot++] = entries[i];
+        }
+        if (inode_write_at (dir->inode, b, sizeof *b, block_ofs (block))
+            != sizeof *b)
+            goto done;
+    }
+    ASSERT (next == h.block_cnt);
+    success = write_header (dir, &h);
+
+    done:
+    free (bucket);
+    free (chain_len);
+    free (b);
+    return success;
+}
+
 /* Adds a file named NAME to DIR, which must not already contain a
    file by that name.  The file's inode is in sector
    INODE_SECTOR.
@@ -141,6 +463,7 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+    struct dir_header h;
     struct dir_entry e;
     off_t ofs;
     bool success = false;
@@ -152,10 +475,36 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
     if (*name == '\0' || strlen (name) > NAME_MAX)
         return false;
 
+    inode_lock_dir (dir->inode);
+
     /* Check that NAME is not in use. */
     if (lookup (dir, name, NULL, NULL))
         goto done;
 
+    memset (&e, 0, sizeof e);
+    e.in_use = true;
+    strlcpy (e.name, name, sizeof e.name);
+    e.inode_sector = inode_sector;
+
+    if (read_header (dir, &h))
+    {
+        /* Double the table once it is 3/4 full. */
+        if ((h.entry_cnt + 1) * 4 > h.bucket_cnt * DIR_BUCKET_ENTRIES * 3)
+        {
+            struct dir_entry *entries;
+            size_t cnt;
+
+            if (!collect_entries (dir, &entries, &cnt))
+                goto done;
+            success = rebuild (dir, entries, cnt, h.bucket_cnt * 2);
+            free (entries);
+            if (!success || !read_header (dir, &h))
+                goto done;
+        }
+        success = hashed_insert (dir, &h, &e) && write_header (dir, &h);
+        goto done;
+    }
+
     /* Set OFS to offset of free slot.
        If there are no free slots, then it will be set to the
        current end-of-file.
@@ -163,18 +512,36 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
        inode_read_at() will only return a short read at end of file.
        Otherwise, we'd need to verify that we didn't get a short
        read due to something intermittent such as low memory. */
-    for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-         ofs += sizeof e)
-        if (!e.in_use)
-            break;
+    {
+        struct dir_entry slot;
+        for (ofs = 0;
+             inode_read_at (dir->inode, &slot, sizeof slot, ofs) == sizeof slot;
+             ofs += sizeof slot)
+            if (!slot.in_use)
+                break;
+    }
+
+    if ((size_t) ofs / sizeof e >= DIR_LINEAR_MAX)
+    {
+        /* Too big to stay linear: convert to hashed format. */
+        struct dir_entry *entries;
+        size_t cnt;
+
+        if (!collect_entries (dir, &entries, &cnt))
+            goto done;
+        entries[cnt++] = e;
+        success = rebuild (dir, entries, cnt, DIR_MIN_BUCKETS);
+        free (entries);
+        goto done;
+    }
 
     /* Write slot. */
-    e.in_use = true;
-    strlcpy (e.name, name, sizeof e.name);
-    e.inode_sector = inode_sector;
     success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 
     done:
+    if (success)
+        dcache_insert (inode_get_inumber (dir->inode), name, inode_sector);
+    inode_unlock_dir (dir->inode);
     return success;
 }
 
@@ -184,6 +551,7 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name)
 {
+    struct dir_header h;
     struct dir_entry e;
     struct inode *inode = NULL;
     bool success = false;
@@ -192,6 +560,8 @@ dir_remove (struct dir *dir, const char *name)
     ASSERT (dir != NULL);
     ASSERT (name != NULL);
 
+    inode_lock_dir (dir->inode);
+
     /* Find directory entry. */
     if (!lookup (dir, name, &e, &ofs))
         goto done;
@@ -205,12 +575,19 @@ dir_remove (struct dir *dir, const char *name)
     e.in_use = false;
     if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
         goto done;
+    dcache_insert (inode_get_inumber (dir->inode), name, DCACHE_NEGATIVE);
+    if (read_header (dir, &h))
+    {
+        h.entry_cnt--;
+        write_header (dir, &h);
+    }
 
     /* Remove inode. */
     inode_remove (inode);
     success = true;
 
     done:
+    inode_unlock_dir (dir->inode);
     inode_close (inode);
     return success;
 }
@@ -222,15 +599,17 @@ bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
     struct dir_entry e;
+    bool found = false;
 
-    while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e)
+    inode_lock_dir (dir->inode);
+    while (!found && read_slot (dir, &dir->pos, &e))
     {
-        dir->pos += sizeof e;
         if (e.in_use)
         {
             strlcpy (name, e.name, NAME_MAX + 1);
-            return true;
+            found = true;
         }
     }
-    return false;
+    inode_unlock_dir (dir->inode);
+    return found;
 }
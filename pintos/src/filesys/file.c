@@ -1,5 +1,6 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include "devices/block.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
 
@@ -9,8 +10,17 @@ struct file
     struct inode *inode;        /* File's inode. */
     off_t pos;                  /* Current position. */
     bool deny_write;            /* Has file_deny_write() been called? */
+
+    /* Read-ahead state, see file_read(). */
+    off_t ra_next;              /* Where a sequential read would start. */
+    off_t ra_window;            /* Bytes to keep read ahead, 0 if none. */
+    off_t ra_end;               /* End of what has been read ahead. */
 };
 
+/* Bounds on the read-ahead window. */
+#define FILE_RA_MIN (4 * BLOCK_SECTOR_SIZE)
+#define FILE_RA_MAX (32 * BLOCK_SECTOR_SIZE)
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -23,6 +33,9 @@ file_open (struct inode *inode)
         file->inode = inode;
         file->pos = 0;
         file->deny_write = false;
+        file->ra_next = -1;
+        file->ra_window = 0;
+        file->ra_end = 0;
         return file;
     }
     else
@@ -64,12 +77,45 @@ file_get_inode (struct file *file)
    starting at the file's current position.
    Returns the number of bytes actually read,
    which may be less than SIZE if end of file is reached.
-   Advances FILE's position by the number of bytes read. */
+   Advances FILE's position by the number of bytes read.
+
+   A read that starts where the previous one ended is taken as a
+   sign of sequential access: the read-ahead window opens, or
+   doubles up to FILE_RA_MAX, and the bytes within the window
+   past this read are fetched in the background.  Any other read
+   closes the window, so random access causes no read-ahead. */
 off_t
 file_read (struct file *file, void *buffer, off_t size)
 {
-    off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+    off_t bytes_read;
+
+    if (file->pos == file->ra_next)
+    {
+        if (file->ra_window == 0)
+            file->ra_window = FILE_RA_MIN;
+        else if (file->ra_window < FILE_RA_MAX)
+            file->ra_window *= 2;
+    }
+    else
+    {
+        file->ra_window = 0;
+        file->ra_end = 0;
+    }
+
+    bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
     file->pos += bytes_read;
+    file->ra_next = file->pos;
+
+    if (file->ra_window > 0)
+    {
+        off_t start = file->ra_end > file->pos ? file->ra_end : file->pos;
+        off_t end = file->pos + file->ra_window;
+        if (start < end)
+        {
+            inode_prefetch (file->inode, start, end);
+            file->ra_end = end;
+        }
+    }
     return bytes_read;
 }
 
@@ -87,9 +133,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size)
@@ -102,9 +147,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk fills up.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
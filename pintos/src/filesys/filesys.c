@@ -2,15 +2,29 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
 #include "filesys/directory.h"
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/thread.h"
 
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* Ticks between two background write-backs of file system
+   data.  Bounds how much work a crash can lose. */
+#define FILESYS_SYNC_INTERVAL (2 * TIMER_FREQ)
+
+/* Kept open so that opening the root directory finds its inode
+   already in memory. */
+static struct dir *root_dir;
+
 static void do_format (void);
+static thread_func filesys_syncer;
 
 /* Initializes the file system module.
    If FORMAT is true, reformats the file system. */
@@ -21,6 +35,8 @@ filesys_init (bool format)
     if (fs_device == NULL)
         PANIC ("No file system device found, can't initialize file system.");
 
+    cache_init ();
+    dcache_init ();
     inode_init ();
     free_map_init ();
 
@@ -28,6 +44,11 @@ filesys_init (bool format)
         do_format ();
 
     free_map_open ();
+    root_dir = dir_open_root ();
+    if (root_dir == NULL)
+        PANIC ("root directory open failed");
+
+    thread_create ("fs-sync", PRI_DEFAULT, filesys_syncer, NULL);
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,7 +56,14 @@ filesys_init (bool format)
 void
 filesys_done (void)
 {
+    /* A kernel panic shuts down with interrupts off, when no disk
+       I/O is possible.  Treat that like a crash. */
+    if (intr_get_level () == INTR_OFF)
+        return;
+
+    dir_close (root_dir);
     free_map_close ();
+    cache_done ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -90,6 +118,19 @@ filesys_remove (const char *name)
     return success;
 }
 
+/* Writes the free map and then every dirty cached sector back
+   to disk, once every FILESYS_SYNC_INTERVAL ticks. */
+static void
+filesys_syncer (void *aux UNUSED)
+{
+    for (;;)
+    {
+        timer_sleep (FILESYS_SYNC_INTERVAL);
+        free_map_flush ();
+        cache_flush ();
+    }
+}
+
 /* Formats the file system. */
 static void
 do_format (void)
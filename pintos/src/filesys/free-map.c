@@ -1,70 +1,321 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <round.h>
+#include <stdint.h>
+#include <stdio.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
-static struct bitmap *free_map;      /* Free map, one bit per sector. */
+
+/* Number of free map bits stored in one sector of its file. */
+#define FREE_MAP_BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* The free map, one bit per sector, is kept in chunks of
+   FREE_MAP_CHUNK_BITS bits, each a bitmap of its own whose bits,
+   with malloc()'s header, fit in a single page.  A device of 4 GB
+   needs a 1 MB free map, which a single bitmap could only get as
+   a run of contiguous pages.  A chunk covers a whole number of
+   free map file sectors and is stored in the file where the
+   whole bitmap would be. */
+#define FREE_MAP_CHUNK_BITS (FREE_MAP_BITS_PER_SECTOR * 7)
+#define FREE_MAP_CHUNK_BYTES (FREE_MAP_CHUNK_BITS / 8)
+static struct bitmap **free_map;     /* Chunks of the free map. */
+static size_t free_map_chunk_cnt;    /* Number of chunks. */
+static size_t free_map_bit_cnt;      /* Bits, one per sector. */
+
+/* Protects the free map, its dirty bitmap and the free-extent
+   index below. */
+static struct lock free_map_lock;
+
+/* Changes to the free map are not written through to the free map
+   file.  Instead, this records which sectors of the file are out
+   of date, and free_map_flush() writes just those. */
+static struct bitmap *free_map_dirty; /* One bit per free map file sector. */
+
+/* Free-extent index.
+
+   The bitmap above is what is stored on disk, but allocation
+   decisions are made from an in-memory index of the maximal runs
+   of free sectors, rebuilt from the bitmap whenever it is read.
+   Runs are kept in segregated lists by size class, so finding a
+   run of a given size usually looks at O(log sectors) lists and
+   a few runs instead of scanning the bitmap, and in hash tables
+   by first and by one-past-last sector, so that freed sectors
+   coalesce with their neighbours in constant time.  The lists
+   are not sorted, so a request whose own class is the largest
+   one with any runs may have to walk that whole class; see
+   index_find(). */
+
+/* Number of size classes.  Class K holds runs of 2**K to
+   2**(K + 1) - 1 sectors. */
+#define FREE_MAP_CLASSES 32
+
+/* Number of runs examined for a best fit within the request's
+   own size class before moving on to larger classes. */
+#define FREE_MAP_FIT_SCAN 8
+
+/* Number of bits index_rebuild() steps over at once inside a run
+   of sectors that are all in use or all free, which keeps
+   rebuilding the index of a multi-gigabyte device quick. */
+#define FREE_MAP_REBUILD_STEP 32
+
+/* A maximal run of free sectors. */
+struct free_extent
+{
+    block_sector_t start;               /* First free sector. */
+    block_sector_t length;              /* Number of free sectors. */
+    struct list_elem class_elem;        /* Element in free_classes[]. */
+    struct hash_elem start_elem;        /* Element in extents_by_start. */
+    struct hash_elem end_elem;          /* Element in extents_by_end. */
+};
+
+static struct list free_classes[FREE_MAP_CLASSES];
+static struct hash extents_by_start;
+static struct hash extents_by_end;
+static size_t free_sector_cnt;          /* Sum of all run lengths. */
+
+static void index_init (void);
+static void index_rebuild (void);
+static struct free_extent *index_find (size_t cnt);
+static block_sector_t index_take (struct free_extent *, size_t cnt);
+static struct free_extent *index_lookup_start (block_sector_t);
+static void index_add (block_sector_t start, size_t cnt);
+
+/* Returns the chunk holding free map bit *IDX and converts *IDX
+   to an index within that chunk. */
+static struct bitmap *
+fm_chunk (size_t *idx)
+{
+    struct bitmap *chunk = free_map[*idx / FREE_MAP_CHUNK_BITS];
+    *idx %= FREE_MAP_CHUNK_BITS;
+    return chunk;
+}
+
+/* Returns free map bit IDX. */
+static bool
+fm_test (size_t idx)
+{
+    struct bitmap *chunk = fm_chunk (&idx);
+    return bitmap_test (chunk, idx);
+}
+
+/* Sets the CNT free map bits starting at START to VALUE. */
+static void
+fm_set_multiple (size_t start, size_t cnt, bool value)
+{
+    while (cnt > 0)
+    {
+        size_t idx = start;
+        struct bitmap *chunk = fm_chunk (&idx);
+        size_t n = bitmap_size (chunk) - idx;
+
+        if (n > cnt)
+            n = cnt;
+        bitmap_set_multiple (chunk, idx, n, value);
+        start += n;
+        cnt -= n;
+    }
+}
+
+/* Returns true if any of the CNT free map bits starting at START
+   is VALUE. */
+static bool
+fm_contains (size_t start, size_t cnt, bool value)
+{
+    while (cnt > 0)
+    {
+        size_t idx = start;
+        struct bitmap *chunk = fm_chunk (&idx);
+        size_t n = bitmap_size (chunk) - idx;
+
+        if (n > cnt)
+            n = cnt;
+        if (bitmap_contains (chunk, idx, n, value))
+            return true;
+        start += n;
+        cnt -= n;
+    }
+    return false;
+}
+
+/* Returns the size of the free map file, in bytes. */
+static off_t
+fm_file_size (void)
+{
+    return ((free_map_chunk_cnt - 1) * FREE_MAP_CHUNK_BYTES
+            + bitmap_file_size (free_map[free_map_chunk_cnt - 1]));
+}
+
+/* Records that free map bits START through START + CNT - 1
+   have changed. */
+static void
+mark_dirty (block_sector_t start, size_t cnt)
+{
+    size_t first = start / FREE_MAP_BITS_PER_SECTOR;
+    size_t last = (start + cnt - 1) / FREE_MAP_BITS_PER_SECTOR;
+
+    if (cnt > 0)
+        bitmap_set_multiple (free_map_dirty, first, last - first + 1, true);
+}
 
 /* Initializes the free map. */
 void
 free_map_init (void)
 {
-    free_map = bitmap_create (block_size (fs_device));
+    size_t i;
+
+    free_map_bit_cnt = block_size (fs_device);
+    free_map_chunk_cnt = DIV_ROUND_UP (free_map_bit_cnt, FREE_MAP_CHUNK_BITS);
+    free_map = calloc (free_map_chunk_cnt, sizeof *free_map);
     if (free_map == NULL)
         PANIC ("bitmap creation failed--file system device is too large");
-    bitmap_mark (free_map, FREE_MAP_SECTOR);
-    bitmap_mark (free_map, ROOT_DIR_SECTOR);
+    for (i = 0; i < free_map_chunk_cnt; i++)
+    {
+        size_t bits = free_map_bit_cnt - i * FREE_MAP_CHUNK_BITS;
+        free_map[i] = bitmap_create (bits < FREE_MAP_CHUNK_BITS
+                                     ? bits : FREE_MAP_CHUNK_BITS);
+        if (free_map[i] == NULL)
+            PANIC ("bitmap creation failed--file system device is too large");
+    }
+    lock_init (&free_map_lock);
+    fm_set_multiple (FREE_MAP_SECTOR, 1, true);
+    fm_set_multiple (ROOT_DIR_SECTOR, 1, true);
+    free_map_dirty = bitmap_create (DIV_ROUND_UP (fm_file_size (),
+                                                  BLOCK_SECTOR_SIZE));
+    if (free_map_dirty == NULL)
+        PANIC ("free map dirty bitmap creation failed");
+    index_init ();
+    index_rebuild ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
    the first into *SECTORP.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available.  The change reaches the free map file
+   at the next free_map_flush(). */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-    block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-    if (sector != BITMAP_ERROR
-        && free_map_file != NULL
-        && !bitmap_write (free_map, free_map_file))
+    struct free_extent *e;
+    block_sector_t sector;
+
+    if (cnt == 0)
     {
-        bitmap_set_multiple (free_map, sector, cnt, false);
-        sector = BITMAP_ERROR;
+        /* Nothing to allocate; any sector number will do. */
+        *sectorp = 0;
+        return true;
     }
-    if (sector != BITMAP_ERROR)
-        *sectorp = sector;
-    return sector != BITMAP_ERROR;
+
+    lock_acquire (&free_map_lock);
+    e = index_find (cnt);
+    if (e != NULL)
+        sector = index_take (e, cnt);
+    lock_release (&free_map_lock);
+
+    if (e == NULL)
+        return false;
+    *sectorp = sector;
+    return true;
+}
+
+/* Allocates up to CNT consecutive free sectors starting at
+   SECTOR, stopping at the first sector already in use.
+   Returns the number of sectors allocated, which is 0 if SECTOR
+   is in use or past the end of the device, and also if SECTOR is
+   free but does not start a free run, because the sector before
+   it is free as well.  Only the start of a run can be found
+   without scanning. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+    struct free_extent *e;
+    size_t n = 0;
+
+    /* A free SECTOR that follows a sector in use, which is the
+       case when growing an extent, starts a run of its own. */
+    lock_acquire (&free_map_lock);
+    e = index_lookup_start (sector);
+    if (e != NULL && cnt > 0)
+    {
+        n = e->length < cnt ? e->length : cnt;
+        index_take (e, n);
+    }
+    lock_release (&free_map_lock);
+    return n;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
-    ASSERT (bitmap_all (free_map, sector, cnt));
-    bitmap_set_multiple (free_map, sector, cnt, false);
-    bitmap_write (free_map, free_map_file);
+    lock_acquire (&free_map_lock);
+    ASSERT (!fm_contains (sector, cnt, false));
+    fm_set_multiple (sector, cnt, false);
+    mark_dirty (sector, cnt);
+    index_add (sector, cnt);
+    lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map file that are out of date.
+   Called periodically by the file system and when the free map
+   is closed. */
+void
+free_map_flush (void)
+{
+    size_t i;
+
+    if (free_map_file == NULL)
+        return;
+
+    /* The free map file never grows, so writing it does not
+       re-enter the free map. */
+    lock_acquire (&free_map_lock);
+    for (i = 0; i < bitmap_size (free_map_dirty); i++)
+    {
+        size_t idx = i * FREE_MAP_BITS_PER_SECTOR;
+        size_t chunk_no = idx / FREE_MAP_CHUNK_BITS;
+        struct bitmap *chunk = fm_chunk (&idx);
+
+        if (bitmap_test (free_map_dirty, i)
+            && bitmap_write_range (chunk, free_map_file,
+                                   chunk_no * FREE_MAP_CHUNK_BYTES,
+                                   idx, FREE_MAP_BITS_PER_SECTOR))
+            bitmap_reset (free_map_dirty, i);
+    }
+    lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
 free_map_open (void)
 {
+    size_t i;
+
     free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
     if (free_map_file == NULL)
         PANIC ("can't open free map");
-    if (!bitmap_read (free_map, free_map_file))
-        PANIC ("can't read free map");
+    for (i = 0; i < free_map_chunk_cnt; i++)
+        if (!bitmap_read_at (free_map[i], free_map_file,
+                             i * FREE_MAP_CHUNK_BYTES))
+            PANIC ("can't read free map");
+    bitmap_set_all (free_map_dirty, false);
+    index_rebuild ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void)
 {
+    free_map_flush ();
     file_close (free_map_file);
+    free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
@@ -72,14 +323,329 @@ free_map_close (void)
 void
 free_map_create (void)
 {
+    size_t i;
+
     /* Create inode. */
-    if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
+    if (!inode_create (FREE_MAP_SECTOR, fm_file_size ()))
         PANIC ("free map creation failed");
 
     /* Write bitmap to file. */
     free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
     if (free_map_file == NULL)
         PANIC ("can't open free map");
-    if (!bitmap_write (free_map, free_map_file))
-        PANIC ("can't write free map");
+    for (i = 0; i < free_map_chunk_cnt; i++)
+        if (!bitmap_write_at (free_map[i], free_map_file,
+                              i * FREE_MAP_CHUNK_BYTES))
+            PANIC ("can't write free map");
+    bitmap_set_all (free_map_dirty, false);
+}
+
+/* Fills in *STATS with a description of the free space. */
+void
+free_map_get_stats (struct free_map_stats *stats)
+{
+    int k;
+
+    lock_acquire (&free_map_lock);
+    stats->free_cnt = free_sector_cnt;
+    stats->extent_cnt = hash_size (&extents_by_start);
+    stats->largest = 0;
+    for (k = FREE_MAP_CLASSES - 1; k >= 0; k--)
+        if (!list_empty (&free_classes[k]))
+        {
+            struct list_elem *el;
+            for (el = list_begin (&free_classes[k]);
+                 el != list_end (&free_classes[k]); el = list_next (el))
+            {
+                struct free_extent *e = list_entry (el, struct free_extent,
+                                                    class_elem);
+                if (e->length > stats->largest)
+                    stats->largest = e->length;
+            }
+            break;
+        }
+    lock_release (&free_map_lock);
+}
+
+/* Prints free space and fragmentation statistics. */
+void
+free_map_print_stats (void)
+{
+    struct free_map_stats stats;
+
+    if (free_map == NULL)
+        return;
+    free_map_get_stats (&stats);
+    printf ("Free map: %zu free sectors in %zu extents, largest %zu "
+            "(%zu%% fragmented)\n",
+            stats.free_cnt, stats.extent_cnt, stats.largest,
+            stats.free_cnt > 0
+            ? 100 - stats.largest * 100 / stats.free_cnt : 0);
+}
+
+/* Free-extent index. */
+
+/* Returns the size class of a run of CNT sectors. */
+static int
+size_class (size_t cnt)
+{
+    int k = 0;
+
+    ASSERT (cnt > 0);
+    while (cnt >>= 1)
+        k++;
+    return k < FREE_MAP_CLASSES ? k : FREE_MAP_CLASSES - 1;
+}
+
+static unsigned
+extent_start_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int (hash_entry (e, struct free_extent, start_elem)->start);
+}
+
+static bool
+extent_start_less (const struct hash_elem *a, const struct hash_elem *b,
+                   void *aux UNUSED)
+{
+    return (hash_entry (a, struct free_extent, start_elem)->start
+            < hash_entry (b, struct free_extent, start_elem)->start);
+}
+
+/* One past the last sector of E. */
+static inline block_sector_t
+extent_end (const struct free_extent *e)
+{
+    return e->start + e->length;
+}
+
+static unsigned
+extent_end_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int (extent_end (hash_entry (e, struct free_extent, end_elem)));
+}
+
+static bool
+extent_end_less (const struct hash_elem *a, const struct hash_elem *b,
+                 void *aux UNUSED)
+{
+    return (extent_end (hash_entry (a, struct free_extent, end_elem))
+            < extent_end (hash_entry (b, struct free_extent, end_elem)));
+}
+
+/* Initializes the empty index. */
+static void
+index_init (void)
+{
+    int k;
+
+    for (k = 0; k < FREE_MAP_CLASSES; k++)
+        list_init (&free_classes[k]);
+    if (!hash_init (&extents_by_start, extent_start_hash, extent_start_less,
+                    NULL)
+        || !hash_init (&extents_by_end, extent_end_hash, extent_end_less, NULL))
+        PANIC ("free map index creation failed");
+    free_sector_cnt = 0;
+}
+
+/* Links E into the index. */
+static void
+index_insert (struct free_extent *e)
+{
+    list_push_front (&free_classes[size_class (e->length)], &e->class_elem);
+    hash_insert (&extents_by_start, &e->start_elem);
+    hash_insert (&extents_by_end, &e->end_elem);
+    free_sector_cnt += e->length;
+}
+
+/* Unlinks E from the index. */
+static void
+index_remove (struct free_extent *e)
+{
+    list_remove (&e->class_elem);
+    hash_delete (&extents_by_start, &e->start_elem);
+    hash_delete (&extents_by_end, &e->end_elem);
+    free_sector_cnt -= e->length;
+}
+
+/* Frees the run embedding HASH_ELEM. */
+static void
+extent_destroy (struct hash_elem *e, void *aux UNUSED)
+{
+    free (hash_entry (e, struct free_extent, start_elem));
+}
+
+/* Discards the index and rebuilds it from the bitmap. */
+static void
+index_rebuild (void)
+{
+    size_t sector_cnt = free_map_bit_cnt;
+    size_t i;
+    int k;
+
+    hash_clear (&extents_by_end, NULL);
+    hash_clear (&extents_by_start, extent_destroy);
+    for (k = 0; k < FREE_MAP_CLASSES; k++)
+        list_init (&free_classes[k]);
+    free_sector_cnt = 0;
+
+    for (i = 0; i < sector_cnt; )
+    {
+        size_t start;
+
+        if (i % FREE_MAP_REBUILD_STEP == 0
+            && sector_cnt - i >= FREE_MAP_REBUILD_STEP
+            && !fm_contains (i, FREE_MAP_REBUILD_STEP, false))
+        {
+            i += FREE_MAP_REBUILD_STEP;
+            continue;
+        }
+        if (fm_test (i))
+        {
+            i++;
+            continue;
+        }
+        for (start = i; i < sector_cnt; )
+            if (i % FREE_MAP_REBUILD_STEP == 0
+                && sector_cnt - i >= FREE_MAP_REBUILD_STEP
+                && !fm_contains (i, FREE_MAP_REBUILD_STEP, true))
+                i += FREE_MAP_REBUILD_STEP;
+            else if (!fm_test (i))
+                i++;
+            else
+                break;
+        index_add (start, i - start);
+    }
+}
+
+/* Returns the run that starts at SECTOR, if any. */
+static struct free_extent *
+index_lookup_start (block_sector_t sector)
+{
+    struct free_extent key;
+    struct hash_elem *e;
+
+    key.start = sector;
+    e = hash_find (&extents_by_start, &key.start_elem);
+    return e != NULL ? hash_entry (e, struct free_extent, start_elem) : NULL;
+}
+
+/* Returns the run that ends just before SECTOR, if any. */
+static struct free_extent *
+index_lookup_end (block_sector_t sector)
+{
+    struct free_extent key;
+    struct hash_elem *e;
+
+    key.start = sector;
+    key.length = 0;
+    e = hash_find (&extents_by_end, &key.end_elem);
+    return e != NULL ? hash_entry (e, struct free_extent, end_elem) : NULL;
+}
+
+/* Returns the best fit among the first LIMIT runs of size class
+   K that are at least CNT sectors long, or a null pointer. */
+static struct free_extent *
+class_best_fit (int k, size_t cnt, size_t limit)
+{
+    struct free_extent *best = NULL;
+    struct list_elem *el;
+    size_t scanned = 0;
+
+    for (el = list_begin (&free_classes[k]);
+         el != list_end (&free_classes[k]) && scanned < limit;
+         el = list_next (el), scanned++)
+    {
+        struct free_extent *e = list_entry (el, struct free_extent, class_elem);
+        if (e->length >= cnt && (best == NULL || e->length < best->length))
+        {
+            best = e;
+            if (e->length == cnt)
+                break;
+        }
+    }
+    return best;
+}
+
+/* Returns a run of at least CNT sectors, or a null pointer if
+   there is none.  Looks for a best fit among a few runs of CNT's
+   own size class, then takes the first run of the smallest
+   larger class, which is guaranteed to fit.  Only if there is
+   none does it search the rest of CNT's class, so in the worst
+   case, when CNT's class is the largest one with any runs, this
+   takes time linear in the number of runs in that class. */
+static struct free_extent *
+index_find (size_t cnt)
+{
+    int k = size_class (cnt);
+    struct free_extent *e;
+    int j;
+
+    e = class_best_fit (k, cnt, FREE_MAP_FIT_SCAN);
+    if (e != NULL)
+        return e;
+
+    for (j = k + 1; j < FREE_MAP_CLASSES; j++)
+        if (!list_empty (&free_classes[j]))
+            return list_entry (list_front (&free_classes[j]),
+                               struct free_extent, class_elem);
+
+    return class_best_fit (k, cnt, SIZE_MAX);
+}
+
+/* Allocates the first CNT sectors of run E, which must be at
+   least that long, and returns the first of them. */
+static block_sector_t
+index_take (struct free_extent *e, size_t cnt)
+{
+    block_sector_t start = e->start;
+
+    ASSERT (cnt > 0 && cnt <= e->length);
+    index_remove (e);
+    if (e->length > cnt)
+    {
+        e->start += cnt;
+        e->length -= cnt;
+        index_insert (e);
+    }
+    else
+        free (e);
+    fm_set_multiple (start, cnt, true);
+    mark_dirty (start, cnt);
+    return start;
+}
+
+/* Adds the CNT free sectors starting at START to the index,
+   merging them with adjacent runs. */
+static void
+index_add (block_sector_t start, size_t cnt)
+{
+    struct free_extent *prev = index_lookup_end (start);
+    struct free_extent *next = index_lookup_start (start + cnt);
+    struct free_extent *e = NULL;
+
+    if (prev != NULL)
+    {
+        index_remove (prev);
+        start = prev->start;
+        cnt += prev->length;
+        e = prev;
+    }
+    if (next != NULL)
+    {
+        index_remove (next);
+        cnt += next->length;
+        if (e == NULL)
+            e = next;
+        else
+            free (next);
+    }
+    if (e == NULL)
+    {
+        e = malloc (sizeof *e);
+        if (e == NULL)
+            PANIC ("free map index: out of memory");
+    }
+    e->start = start;
+    e->length = cnt;
+    index_insert (e);
 }
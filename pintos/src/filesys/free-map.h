@@ -10,8 +10,21 @@ void free_map_read (void);
 void free_map_create (void);
 void free_map_open (void);
 void free_map_close (void);
+void free_map_flush (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+size_t free_map_allocate_at (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
 
+/* Free space statistics. */
+struct free_map_stats
+{
+    size_t free_cnt;                    /* Free sectors. */
+    size_t extent_cnt;                  /* Maximal runs of free sectors. */
+    size_t largest;                     /* Sectors in the longest run. */
+};
+
+void free_map_get_stats (struct free_map_stats *);
+void free_map_print_stats (void);
+
 #endif /* filesys/free-map.h */
@@ -1,6 +1,7 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
 #include <stdio.h>
+#include <round.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
@@ -77,9 +78,9 @@ fsutil_extract (char **argv UNUSED)
     struct block *src;
     void *header, *data;
 
-    /* Allocate buffers. */
+    /* Allocate buffers.  File data is copied a page at a time. */
     header = malloc (BLOCK_SECTOR_SIZE);
-    data = malloc (BLOCK_SECTOR_SIZE);
+    data = palloc_get_page (0);
     if (header == NULL || data == NULL)
         PANIC ("couldn't allocate buffers");
 
@@ -127,10 +128,13 @@ fsutil_extract (char **argv UNUSED)
             /* Do copy. */
             while (size > 0)
             {
-                int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                  ? BLOCK_SECTOR_SIZE
-                                  : size);
-                block_read (src, sector++, data);
+                int chunk_size = size > PGSIZE ? PGSIZE : size;
+                struct block_iovec iov;
+
+                iov.base = data;
+                iov.cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+                block_read_multi (src, sector, &iov, 1);
+                sector += iov.cnt;
                 if (file_write (dst, data, chunk_size) != chunk_size)
                     PANIC ("%s: write failed with %d bytes unwritten",
                            file_name, size);
@@ -151,7 +155,7 @@ fsutil_extract (char **argv UNUSED)
     block_write (src, 0, header);
     block_write (src, 1, header);
 
-    free (data);
+    palloc_free_page (data);
     free (header);
 }
 
@@ -176,8 +180,8 @@ fsutil_append (char **argv)
 
     printf ("Appending '%s' to ustar archive on scratch device...\n", file_name);
 
-    /* Allocate buffer. */
-    buffer = malloc (BLOCK_SECTOR_SIZE);
+    /* Allocate buffer.  File data is copied a page at a time. */
+    buffer = palloc_get_page (0);
     if (buffer == NULL)
         PANIC ("couldn't allocate buffer");
 
@@ -200,13 +204,19 @@ fsutil_append (char **argv)
     /* Do copy. */
     while (size > 0)
     {
-        int chunk_size = size > BLOCK_SECTOR_SIZE ? BLOCK_SECTOR_SIZE : size;
-        if (sector >= block_size (dst))
+        int chunk_size = size > PGSIZE ? PGSIZE : size;
+        struct block_iovec iov;
+
+        iov.base = buffer;
+        iov.cnt = DIV_ROUND_UP (chunk_size, BLOCK_SECTOR_SIZE);
+        if (sector + iov.cnt > block_size (dst))
             PANIC ("%s: out of space on scratch device", file_name);
         if (file_read (src, buffer, chunk_size) != chunk_size)
             PANIC ("%s: read failed with %"PROTd" bytes unread", file_name, size);
-        memset (buffer + chunk_size, 0, BLOCK_SECTOR_SIZE - chunk_size);
-        block_write (dst, sector++, buffer);
+        memset (buffer + chunk_size, 0,
+                iov.cnt * BLOCK_SECTOR_SIZE - chunk_size);
+        block_write_multi (dst, sector, &iov, 1);
+        sector += iov.cnt;
         size -= chunk_size;
     }
 
@@ -219,5 +229,5 @@ fsutil_append (char **argv)
 
     /* Finish up. */
     file_close (src);
-    free (buffer);
+    palloc_free_page (buffer);
 }
@@ -1,23 +1,79 @@
 #include "filesys/inode.h"
-#include <list.h>
+#include <hash.h>
 #include <debug.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/dcache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* Number of extents stored directly in the on-disk inode. */
+#define INODE_DIRECT_EXTENTS 61
+
+/* Number of extents stored in each overflow extent block. */
+#define INODE_OVERFLOW_EXTENTS 63
+
+/* Upper bound on the sectors preallocated past the requested
+   size when a file grows.  A growing file reserves about as many
+   sectors again as it already owns, up to this limit, so that
+   files grown concurrently in small steps do not interleave
+   their sectors. */
+#define INODE_PREALLOC_MAX 64
+
+/* Largest file whose data is kept inside its on-disk inode. */
+#define INODE_INLINE_MAX \
+        ((off_t) (INODE_DIRECT_EXTENTS * sizeof (struct inode_extent)))
+
+/* A run of consecutive sectors on the file system device. */
+struct inode_extent
+{
+    block_sector_t start;               /* First sector. */
+    uint32_t length;                    /* Number of sectors. */
+};
+
 /* On-disk inode.
-   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+   Must be exactly BLOCK_SECTOR_SIZE bytes long.
+
+   A file of up to INODE_INLINE_MAX bytes has no data sectors:
+   its data is kept in INLINE_DATA, in place of the extent list,
+   so reading or writing it touches only the inode's own sector.
+   When it grows past that size it moves to data sectors for
+   good.
+
+   Otherwise the file's data lives in the runs listed in EXTENTS,
+   in file order, followed by those in the chain of overflow
+   blocks that starts at OVERFLOW.  The extents may cover more
+   sectors than LENGTH needs, because growth preallocates. */
 struct inode_disk
 {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t sector_cnt;                /* Data sectors allocated. */
+    uint32_t extent_cnt;                /* Extents in use, in total. */
+    block_sector_t overflow;            /* First overflow block, or 0. */
+    union
+    {
+        struct inode_extent extents[INODE_DIRECT_EXTENTS];
+        uint8_t inline_data[INODE_INLINE_MAX];
+    };
+    uint32_t unused[1];                 /* Not used. */
+};
+
+/* Overflow extent block, holding the extents of a file past the
+   first INODE_DIRECT_EXTENTS.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct inode_overflow
+{
+    struct inode_extent extents[INODE_OVERFLOW_EXTENTS];
+    block_sector_t next;                /* Next overflow block, or 0. */
+    uint32_t unused;                    /* Not used. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -28,17 +84,371 @@ bytes_to_sectors (off_t size)
     return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* Returns true if DATA keeps its file's data inline. */
+static inline bool
+inode_is_inline (const struct inode_disk *data)
+{
+    return data->sector_cnt == 0;
+}
+
+/* Returns how many of the SIZE bytes starting at OFFSET lie
+   within the LENGTH bytes of DATA's file. */
+static inline off_t
+bytes_within (const struct inode_disk *data, off_t size, off_t offset)
+{
+    off_t left = data->length - offset;
+    return left <= 0 ? 0 : size < left ? size : left;
+}
+
 /* In-memory inode. */
 struct inode
 {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem elem;              /* Element in open_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct rw_lock rw_lock;             /* Protects DATA and DENY_WRITE_CNT. */
+    struct lock dir_lock;               /* Serializes directory updates. */
+    bool loading;                       /* True while DATA is being read. */
+    struct condition loaded;            /* Signaled when DATA is read. */
     struct inode_disk data;             /* Inode content. */
 };
 
+/* A sector full of zeros. */
+static char zeros[BLOCK_SECTOR_SIZE];
+
+/* Returns the overflow block that follows BLOCK. */
+static block_sector_t
+next_overflow (block_sector_t block)
+{
+    block_sector_t next;
+    cache_read_at (block, &next, offsetof (struct inode_overflow, next),
+                   sizeof next);
+    return next;
+}
+
+/* Returns the overflow block that holds extent IDX of DATA.
+   IDX must not refer to a direct extent. */
+static block_sector_t
+overflow_block (const struct inode_disk *data, size_t idx)
+{
+    block_sector_t block = data->overflow;
+    size_t n;
+
+    ASSERT (idx >= INODE_DIRECT_EXTENTS);
+    for (n = (idx - INODE_DIRECT_EXTENTS) / INODE_OVERFLOW_EXTENTS; n > 0; n--)
+        block = next_overflow (block);
+    return block;
+}
+
+/* Byte offset of extent IDX within its overflow block. */
+static inline int
+overflow_ofs (size_t idx)
+{
+    return ((idx - INODE_DIRECT_EXTENTS) % INODE_OVERFLOW_EXTENTS
+            * sizeof (struct inode_extent));
+}
+
+/* Reads extent IDX of DATA into *EXT.  BLOCK must be the
+   overflow block that holds it, or anything for a direct
+   extent. */
+static void
+extent_read (const struct inode_disk *data, size_t idx, block_sector_t block,
+             struct inode_extent *ext)
+{
+    if (idx < INODE_DIRECT_EXTENTS)
+        *ext = data->extents[idx];
+    else
+        cache_read_at (block, ext, overflow_ofs (idx), sizeof *ext);
+}
+
+/* Writes *EXT as extent IDX of DATA.  BLOCK is as for
+   extent_read(). */
+static void
+extent_write (struct inode_disk *data, size_t idx, block_sector_t block,
+              const struct inode_extent *ext)
+{
+    if (idx < INODE_DIRECT_EXTENTS)
+        data->extents[idx] = *ext;
+    else
+        cache_write_at (block, ext, overflow_ofs (idx), sizeof *ext);
+}
+
+/* Advances *BLOCK, the overflow block holding extent IDX of
+   DATA, to the one holding extent IDX + 1, for walking the
+   extents in order.  Start a walk with *BLOCK = DATA->overflow. */
+static void
+extent_step (const struct inode_disk *data, size_t idx, block_sector_t *block)
+{
+    if (idx >= INODE_DIRECT_EXTENTS
+        && overflow_ofs (idx + 1) == 0
+        && idx + 1 < data->extent_cnt)
+        *block = next_overflow (*block);
+}
+
+/* Appends the CNT sectors starting at START to the data of
+   DATA, merging them into the last extent when they follow it
+   directly.  Returns false if an overflow block was needed but
+   could not be allocated. */
+static bool
+extent_append (struct inode_disk *data, block_sector_t start, size_t cnt)
+{
+    struct inode_extent ext;
+    block_sector_t block = 0;
+    size_t idx = data->extent_cnt;
+
+    if (idx > 0)
+    {
+        block_sector_t last_block = (idx - 1 >= INODE_DIRECT_EXTENTS
+                                     ? overflow_block (data, idx - 1) : 0);
+        extent_read (data, idx - 1, last_block, &ext);
+        if (ext.start + ext.length == start)
+        {
+            ext.length += cnt;
+            extent_write (data, idx - 1, last_block, &ext);
+            data->sector_cnt += cnt;
+            return true;
+        }
+        block = last_block;
+    }
+
+    if (idx >= INODE_DIRECT_EXTENTS && overflow_ofs (idx) == 0)
+    {
+        /* Start a new overflow block and link it in. */
+        block_sector_t new_block;
+        if (!free_map_allocate (1, &new_block))
+            return false;
+        cache_write (new_block, zeros);
+        if (idx == INODE_DIRECT_EXTENTS)
+            data->overflow = new_block;
+        else
+            cache_write_at (block, &new_block,
+                            offsetof (struct inode_overflow, next),
+                            sizeof new_block);
+        block = new_block;
+    }
+
+    ext.start = start;
+    ext.length = cnt;
+    extent_write (data, idx, block, &ext);
+    data->extent_cnt++;
+    data->sector_cnt += cnt;
+    return true;
+}
+
+/* Allocates at least NEED more data sectors for DATA, and up to
+   EXTRA beyond that if they come cheaply.  Prefers extending the
+   last extent in place, then the largest run the free map can
+   give.  Returns false if the disk is full, in which case some
+   sectors may have been added anyway. */
+static bool
+inode_allocate (struct inode_disk *data, size_t need, size_t extra)
+{
+    while (need > 0)
+    {
+        block_sector_t start;
+        size_t cnt = 0;
+
+        /* Try to continue the last extent. */
+        if (data->extent_cnt > 0)
+        {
+            size_t idx = data->extent_cnt - 1;
+            struct inode_extent last;
+            extent_read (data, idx,
+                         idx >= INODE_DIRECT_EXTENTS
+                         ? overflow_block (data, idx) : 0, &last);
+            start = last.start + last.length;
+            cnt = free_map_allocate_at (start, need + extra);
+        }
+
+        /* Otherwise take the largest new run we can get. */
+        if (cnt == 0)
+        {
+            for (cnt = need + extra; cnt > 0; cnt /= 2)
+                if (free_map_allocate (cnt, &start))
+                    break;
+            if (cnt == 0)
+                return false;
+        }
+
+        if (!extent_append (data, start, cnt))
+        {
+            free_map_release (start, cnt);
+            return false;
+        }
+
+        if (cnt >= need)
+            break;
+        need -= cnt;
+    }
+    return true;
+}
+
+/* Releases every data sector of DATA past the first KEEP, along
+   with overflow blocks that are no longer needed. */
+static void
+inode_deallocate (struct inode_disk *data, size_t keep)
+{
+    block_sector_t block = data->overflow;
+    size_t idx, pos, new_cnt, block_cnt, n;
+    block_sector_t prev;
+
+    new_cnt = 0;
+    for (idx = pos = 0; idx < data->extent_cnt; idx++)
+    {
+        struct inode_extent ext;
+        size_t length;
+
+        extent_read (data, idx, block, &ext);
+        length = ext.length;
+        if (pos >= keep)
+            free_map_release (ext.start, ext.length);
+        else
+        {
+            if (pos + ext.length > keep)
+            {
+                ext.length = keep - pos;
+                free_map_release (ext.start + ext.length, length - ext.length);
+                extent_write (data, idx, block, &ext);
+            }
+            new_cnt = idx + 1;
+        }
+        pos += length;
+        extent_step (data, idx, &block);
+    }
+
+    /* Free the tail of the overflow chain. */
+    block_cnt = (new_cnt > INODE_DIRECT_EXTENTS
+                 ? DIV_ROUND_UP (new_cnt - INODE_DIRECT_EXTENTS,
+                                 INODE_OVERFLOW_EXTENTS)
+                 : 0);
+    prev = 0;
+    for (block = data->overflow, n = 0; block != 0; n++)
+    {
+        block_sector_t next = next_overflow (block);
+        if (n >= block_cnt)
+        {
+            if (n == block_cnt)
+            {
+                if (prev == 0)
+                    data->overflow = 0;
+                else
+                    cache_write_at (prev, &zeros,
+                                    offsetof (struct inode_overflow, next),
+                                    sizeof (block_sector_t));
+            }
+            free_map_release (block, 1);
+        }
+        prev = block;
+        block = next;
+    }
+
+    data->extent_cnt = new_cnt;
+    if (data->sector_cnt > keep)
+        data->sector_cnt = keep;
+}
+
+/* Zeros data sectors FIRST through LAST - 1 of DATA. */
+static void
+inode_zero (const struct inode_disk *data, size_t first, size_t last)
+{
+    block_sector_t block = data->overflow;
+    size_t idx, pos;
+
+    for (idx = pos = 0; idx < data->extent_cnt && pos < last; idx++)
+    {
+        struct inode_extent ext;
+        size_t lo, hi;
+
+        extent_read (data, idx, block, &ext);
+        lo = first > pos ? first - pos : 0;
+        hi = last - pos < ext.length ? last - pos : ext.length;
+        for (; lo < hi; lo++)
+            cache_write (ext.start + lo, zeros);
+        pos += ext.length;
+        extent_step (data, idx, &block);
+    }
+}
+
+/* Grows DATA, which must not be inline, to LENGTH bytes,
+   allocating and zeroing sectors as needed.  Returns true if
+   successful, false if the disk is full, in which case DATA is
+   unchanged. */
+static bool
+inode_grow_extents (struct inode_disk *data, off_t length)
+{
+    size_t old_sectors = bytes_to_sectors (data->length);
+    size_t new_sectors = bytes_to_sectors (length);
+
+    ASSERT (length >= data->length);
+
+    if (new_sectors > data->sector_cnt)
+    {
+        size_t old_cnt = data->sector_cnt;
+        size_t extra = 0;
+
+        /* Files that are growing are likely to keep growing. */
+        if (data->length > 0)
+            extra = old_cnt < INODE_PREALLOC_MAX ? old_cnt : INODE_PREALLOC_MAX;
+
+        if (!inode_allocate (data, new_sectors - old_cnt, extra))
+        {
+            inode_deallocate (data, old_cnt);
+            return false;
+        }
+    }
+
+    inode_zero (data, old_sectors, new_sectors);
+    data->length = length;
+    return true;
+}
+
+/* Grows DATA to LENGTH bytes.  An inline file stays inline if
+   LENGTH allows; otherwise its data moves to the first of its
+   new data sectors.  Returns true if successful, false if the
+   disk is full or memory runs out, in which case DATA is
+   unchanged. */
+static bool
+inode_grow (struct inode_disk *data, off_t length)
+{
+    uint8_t *buf;
+    off_t old_length;
+
+    ASSERT (length >= data->length);
+
+    if (!inode_is_inline (data))
+        return inode_grow_extents (data, length);
+
+    /* Bytes past the end of inline data are always zero. */
+    if (length <= INODE_INLINE_MAX)
+    {
+        data->length = length;
+        return true;
+    }
+
+    /* Move the inline data out to a data sector. */
+    buf = calloc (1, BLOCK_SECTOR_SIZE);
+    if (buf == NULL)
+        return false;
+    old_length = data->length;
+    memcpy (buf, data->inline_data, old_length);
+    memset (data->inline_data, 0, INODE_INLINE_MAX);
+    data->length = 0;
+    if (inode_grow_extents (data, length))
+    {
+        if (old_length > 0)
+            cache_write (data->extents[0].start, buf);
+        free (buf);
+        return true;
+    }
+
+    memcpy (data->inline_data, buf, INODE_INLINE_MAX);
+    data->length = old_length;
+    free (buf);
+    return false;
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
    Returns -1 if INODE does not contain data for a byte at offset
@@ -46,22 +456,85 @@ struct inode
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos)
 {
+    const struct inode_disk *data;
+    block_sector_t block;
+    size_t idx, ofs;
+
     ASSERT (inode != NULL);
-    if (pos < inode->data.length)
-        return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-    else
+    data = &inode->data;
+    if (pos >= data->length)
         return -1;
+
+    ofs = pos / BLOCK_SECTOR_SIZE;
+    block = data->overflow;
+    for (idx = 0; idx < data->extent_cnt; idx++)
+    {
+        struct inode_extent ext;
+
+        extent_read (data, idx, block, &ext);
+        if (ofs < ext.length)
+            return ext.start + ofs;
+        ofs -= ext.length;
+        extent_step (data, idx, &block);
+    }
+    NOT_REACHED ();
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Calls FN once for each run of consecutive disk sectors that
+   holds part of bytes START up to END of DATA's file, passing the
+   run's first sector and length.  Bytes past the end of the file
+   and inline data are ignored. */
+static void
+for_each_run (const struct inode_disk *data, off_t start, off_t end,
+              void (*fn) (block_sector_t, size_t))
+{
+    block_sector_t block;
+    size_t first, last, base, idx;
+
+    if (end > data->length)
+        end = data->length;
+    if (start >= end)
+        return;
+
+    /* Pass on the part of each extent that falls within sectors
+       FIRST...LAST of the file. */
+    first = start / BLOCK_SECTOR_SIZE;
+    last = (end - 1) / BLOCK_SECTOR_SIZE;
+    base = 0;
+    block = data->overflow;
+    for (idx = 0; idx < data->extent_cnt && base <= last; idx++)
+    {
+        struct inode_extent ext;
+        size_t lo, hi;
+
+        extent_read (data, idx, block, &ext);
+        lo = first > base ? first - base : 0;
+        hi = last - base < ext.length - 1 ? last - base : ext.length - 1;
+        if (lo <= hi && lo < ext.length)
+            fn (ext.start + lo, hi - lo + 1);
+        base += ext.length;
+        extent_step (data, idx, &block);
+    }
+}
+
+/* Open inodes, keyed by sector, so that opening a single inode
+   twice returns the same `struct inode'. */
+static struct hash open_inodes;
+
+/* Protects open_inodes and the OPEN_CNT and LOADING members of
+   every open inode. */
+static struct lock open_inodes_lock;
+
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void)
 {
-    list_init (&open_inodes);
+    if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+        PANIC ("open inode table creation failed");
+    lock_init (&open_inodes_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -80,24 +553,15 @@ inode_create (block_sector_t sector, off_t length)
     /* If this assertion fails, the inode structure is not exactly
        one sector in size, and you should fix that. */
     ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
+    ASSERT (sizeof (struct inode_overflow) == BLOCK_SECTOR_SIZE);
 
     disk_inode = calloc (1, sizeof *disk_inode);
     if (disk_inode != NULL)
     {
-        size_t sectors = bytes_to_sectors (length);
-        disk_inode->length = length;
         disk_inode->magic = INODE_MAGIC;
-        if (free_map_allocate (sectors, &disk_inode->start))
+        if (inode_grow (disk_inode, length))
         {
-            block_write (fs_device, sector, disk_inode);
-            if (sectors > 0)
-            {
-                static char zeros[BLOCK_SECTOR_SIZE];
-                size_t i;
-
-                for (i = 0; i < sectors; i++)
-                    block_write (fs_device, disk_inode->start + i, zeros);
-            }
+            cache_write (sector, disk_inode);
             success = true;
         }
         free (disk_inode);
@@ -111,33 +575,53 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-    struct list_elem *e;
+    struct inode key;
+    struct hash_elem *e;
     struct inode *inode;
 
+    lock_acquire (&open_inodes_lock);
+
     /* Check whether this inode is already open. */
-    for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-         e = list_next (e))
+    key.sector = sector;
+    e = hash_find (&open_inodes, &key.elem);
+    if (e != NULL)
     {
-        inode = list_entry (e, struct inode, elem);
-        if (inode->sector == sector)
-        {
-            inode_reopen (inode);
-            return inode;
-        }
+        inode = hash_entry (e, struct inode, elem);
+        inode->open_cnt++;
+        while (inode->loading)
+            cond_wait (&inode->loaded, &open_inodes_lock);
+        lock_release (&open_inodes_lock);
+        return inode;
     }
 
     /* Allocate memory. */
     inode = malloc (sizeof *inode);
     if (inode == NULL)
+    {
+        lock_release (&open_inodes_lock);
         return NULL;
+    }
 
-    /* Initialize. */
-    list_push_front (&open_inodes, &inode->elem);
+    /* Initialize.  The inode is published while it is still being
+       read, so that the disk read does not hold up opens of other
+       inodes; openers of this one wait until it is loaded. */
     inode->sector = sector;
     inode->open_cnt = 1;
     inode->deny_write_cnt = 0;
     inode->removed = false;
-    block_read (fs_device, inode->sector, &inode->data);
+    rw_lock_init (&inode->rw_lock);
+    lock_init (&inode->dir_lock);
+    inode->loading = true;
+    cond_init (&inode->loaded);
+    hash_insert (&open_inodes, &inode->elem);
+    lock_release (&open_inodes_lock);
+
+    cache_read (inode->sector, &inode->data);
+
+    lock_acquire (&open_inodes_lock);
+    inode->loading = false;
+    cond_broadcast (&inode->loaded, &open_inodes_lock);
+    lock_release (&open_inodes_lock);
     return inode;
 }
 
@@ -146,7 +630,11 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
     if (inode != NULL)
+    {
+        lock_acquire (&open_inodes_lock);
         inode->open_cnt++;
+        lock_release (&open_inodes_lock);
+    }
     return inode;
 }
 
@@ -168,21 +656,25 @@ inode_close (struct inode *inode)
         return;
 
     /* Release resources if this was the last opener. */
+    lock_acquire (&open_inodes_lock);
     if (--inode->open_cnt == 0)
     {
-        /* Remove from inode list and release lock. */
-        list_remove (&inode->elem);
+        /* Remove from inode table and release lock. */
+        hash_delete (&open_inodes, &inode->elem);
+        lock_release (&open_inodes_lock);
 
         /* Deallocate blocks if removed. */
         if (inode->removed)
         {
+            dcache_invalidate_dir (inode->sector);
+            inode_deallocate (&inode->data, 0);
             free_map_release (inode->sector, 1);
-            free_map_release (inode->data.start,
-                              bytes_to_sectors (inode->data.length));
         }
 
         free (inode);
     }
+    else
+        lock_release (&open_inodes_lock);
 }
 
 /* Marks INODE to be deleted when it is closed by the last caller who
@@ -202,7 +694,16 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
     uint8_t *buffer = buffer_;
     off_t bytes_read = 0;
-    uint8_t *bounce = NULL;
+    off_t loaded_end = 0;
+
+    rw_lock_acquire_read (&inode->rw_lock);
+    if (inode_is_inline (&inode->data))
+    {
+        bytes_read = bytes_within (&inode->data, size, offset);
+        memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        rw_lock_release_read (&inode->rw_lock);
+        return bytes_read;
+    }
 
     while (size > 0)
     {
@@ -211,7 +712,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
         int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
-        off_t inode_left = inode_length (inode) - offset;
+        off_t inode_left = inode->data.length - offset;
         int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
         int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,50 +721,84 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
         if (chunk_size <= 0)
             break;
 
-        if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+        /* Bring in a read that spans sectors with one request per
+           extent, rather than one per sector.  Only the next
+           cache_load_limit() sectors are loaded at a time, so that
+           a long read does not evict what it loaded before copying
+           it out. */
+        if (offset >= loaded_end && size > sector_left)
         {
-            /* Read full sector directly into caller's buffer. */
-            block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-        else
-        {
-            /* Read sector into bounce buffer, then partially copy
-               into caller's buffer. */
-            if (bounce == NULL)
-            {
-                bounce = malloc (BLOCK_SECTOR_SIZE);
-                if (bounce == NULL)
-                    break;
-            }
-            block_read (fs_device, sector_idx, bounce);
-            memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+            loaded_end = (offset / BLOCK_SECTOR_SIZE + cache_load_limit ())
+                         * BLOCK_SECTOR_SIZE;
+            if (loaded_end > offset + size)
+                loaded_end = offset + size;
+            for_each_run (&inode->data, offset, loaded_end, cache_load);
         }
 
+        /* Copy out of the buffer cache. */
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
+
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_read += chunk_size;
     }
-    free (bounce);
+    rw_lock_release_read (&inode->rw_lock);
 
     return bytes_read;
 }
 
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up while extending INODE. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset)
 {
     const uint8_t *buffer = buffer_;
     off_t bytes_written = 0;
-    uint8_t *bounce = NULL;
 
+    /* Extending the file, or writing inline data, excludes every
+       other reader and writer of INODE.  If extending fails, write
+       whatever fits within the current length. */
+    if (offset + size > inode_length (inode)
+        || inode_is_inline (&inode->data))
+    {
+        bool dirty = false, done = true;
+
+        rw_lock_acquire_write (&inode->rw_lock);
+        if (inode->deny_write_cnt == 0)
+        {
+            if (offset + size > inode->data.length
+                && inode_grow (&inode->data, offset + size))
+                dirty = true;
+            if (inode_is_inline (&inode->data))
+            {
+                bytes_written = bytes_within (&inode->data, size, offset);
+                memcpy (inode->data.inline_data + offset, buffer,
+                        bytes_written);
+                if (bytes_written > 0)
+                    dirty = true;
+            }
+            else
+                done = false;
+            if (dirty)
+                cache_write (inode->sector, &inode->data);
+        }
+        rw_lock_release_write (&inode->rw_lock);
+
+        if (done)
+            return bytes_written;
+    }
+
+    /* Writes within the file share INODE with readers and other
+       writers; the buffer cache keeps each sector consistent. */
+    rw_lock_acquire_read (&inode->rw_lock);
     if (inode->deny_write_cnt)
+    {
+        rw_lock_release_read (&inode->rw_lock);
         return 0;
+    }
 
     while (size > 0)
     {
@@ -272,7 +807,7 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
         int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
         /* Bytes left in inode, bytes left in sector, lesser of the two. */
-        off_t inode_left = inode_length (inode) - offset;
+        off_t inode_left = inode->data.length - offset;
         int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
         int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,49 +816,41 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
         if (chunk_size <= 0)
             break;
 
-        if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-            /* Write full sector directly to disk. */
-            block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-        else
-        {
-            /* We need a bounce buffer. */
-            if (bounce == NULL)
-            {
-                bounce = malloc (BLOCK_SECTOR_SIZE);
-                if (bounce == NULL)
-                    break;
-            }
-
-            /* If the sector contains data before or after the chunk
-               we're writing, then we need to read in the sector
-               first.  Otherwise we start with a sector of all zeros. */
-            if (sector_ofs > 0 || chunk_size < sector_left)
-                block_read (fs_device, sector_idx, bounce);
-            else
-                memset (bounce, 0, BLOCK_SECTOR_SIZE);
-            memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-            block_write (fs_device, sector_idx, bounce);
-        }
+        /* Write into the buffer cache, which reads the sector in
+           first only if the chunk does not cover all of it. */
+        cache_write_at (sector_idx, buffer + bytes_written,
+                        sector_ofs, chunk_size);
 
         /* Advance. */
         size -= chunk_size;
         offset += chunk_size;
         bytes_written += chunk_size;
     }
-    free (bounce);
+    rw_lock_release_read (&inode->rw_lock);
 
     return bytes_written;
 }
 
+/* Asks for the sectors of INODE that hold bytes START up to END
+   to be read into the buffer cache in the background.  Bytes past
+   the end of INODE are ignored. */
+void
+inode_prefetch (struct inode *inode, off_t start, off_t end)
+{
+    rw_lock_acquire_read (&inode->rw_lock);
+    for_each_run (&inode->data, start, end, cache_prefetch);
+    rw_lock_release_read (&inode->rw_lock);
+}
+
 /* Disables writes to INODE.
    May be called at most once per inode opener. */
 void
 inode_deny_write (struct inode *inode)
 {
+    rw_lock_acquire_write (&inode->rw_lock);
     inode->deny_write_cnt++;
     ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+    rw_lock_release_write (&inode->rw_lock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +859,49 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode)
 {
+    rw_lock_acquire_write (&inode->rw_lock);
     ASSERT (inode->deny_write_cnt > 0);
     ASSERT (inode->deny_write_cnt <= inode->open_cnt);
     inode->deny_write_cnt--;
+    rw_lock_release_write (&inode->rw_lock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.  The length only
+   grows while INODE is open, and reading it is atomic, so no lock
+   is needed. */
 off_t
 inode_length (const struct inode *inode)
 {
     return inode->data.length;
 }
+
+/* Acquires INODE's directory lock, which a directory holds while
+   searching or changing its entries. */
+void
+inode_lock_dir (struct inode *inode)
+{
+    lock_acquire (&inode->dir_lock);
+}
+
+/* Releases INODE's directory lock. */
+void
+inode_unlock_dir (struct inode *inode)
+{
+    lock_release (&inode->dir_lock);
+}
+
+/* Hash function for open_inodes. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+    return hash_int (hash_entry (e, struct inode, elem)->sector);
+}
+
+/* Comparison function for open_inodes. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+    return (hash_entry (a, struct inode, elem)->sector
+            < hash_entry (b, struct inode, elem)->sector);
+}
@@ -248,14 +248,23 @@ bitmap_count (const struct bitmap *b, size_t start, size_t cnt, bool value)
 bool
 bitmap_contains (const struct bitmap *b, size_t start, size_t cnt, bool value) 
 {
-  size_t i;
+  elem_type none = value ? 0 : (elem_type) -1;
+  size_t i, end;
   
   ASSERT (b != NULL);
   ASSERT (start <= b->bit_cnt);
   ASSERT (start + cnt <= b->bit_cnt);
 
-  for (i = 0; i < cnt; i++)
-    if (bitmap_test (b, start + i) == value)
+  /* Whole elements are tested at once. */
+  end = start + cnt;
+  for (i = start; i < end; )
+    if (i % ELEM_BITS == 0 && end - i >= ELEM_BITS)
+      {
+        if (b->bits[elem_idx (i)] != none)
+          return true;
+        i += ELEM_BITS;
+      }
+    else if (bitmap_test (b, i++) == value)
       return true;
   return false;
 }
@@ -337,12 +346,20 @@ bitmap_file_size (const struct bitmap *b)
    otherwise. */
 bool
 bitmap_read (struct bitmap *b, struct file *file) 
+{
+  return bitmap_read_at (b, file, 0);
+}
+
+/* Reads B from FILE, in which it is stored starting at byte OFS.
+   Returns true if successful, false otherwise. */
+bool
+bitmap_read_at (struct bitmap *b, struct file *file, off_t ofs)
 {
   bool success = true;
   if (b->bit_cnt > 0) 
     {
       off_t size = byte_cnt (b->bit_cnt);
-      success=file_read_at(file, b->bits, size, 0) == size;
+      success=file_read_at(file, b->bits, size, ofs) == size;
       b->bits[elem_cnt (b->bit_cnt) - 1] &= last_mask (b);
     }
   return success;
@@ -352,9 +369,41 @@ bitmap_read (struct bitmap *b, struct file *file)
    otherwise. */
 bool
 bitmap_write (const struct bitmap *b, struct file *file)
+{
+  return bitmap_write_at (b, file, 0);
+}
+
+/* Writes B to FILE starting at byte OFS.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_at (const struct bitmap *b, struct file *file, off_t ofs)
 {
   off_t size = byte_cnt(b->bit_cnt);
-  return file_write_at (file, b->bits, size, 0) == size;
+  return file_write_at (file, b->bits, size, ofs) == size;
+}
+
+/* Writes the part of B that holds bits START through START + CNT
+   - 1, rounded out to whole elements, to the same place in FILE
+   that bitmap_write_at() would put it given OFS.  Bits past the
+   end of B are ignored.  Return true if successful, false
+   otherwise. */
+bool
+bitmap_write_range (const struct bitmap *b, struct file *file, off_t ofs,
+                    size_t start, size_t cnt)
+{
+  size_t first, last;
+  off_t size;
+
+  if (start >= b->bit_cnt || cnt == 0)
+    return true;
+  if (cnt > b->bit_cnt - start)
+    cnt = b->bit_cnt - start;
+
+  first = elem_idx (start);
+  last = elem_idx (start + cnt - 1);
+  size = (last - first + 1) * sizeof (elem_type);
+  return file_write_at (file, b->bits + first, size,
+                        ofs + first * sizeof (elem_type)) == size;
 }
 #endif /* FILESYS */
 
@@ -0,0 +1,81 @@
+/* Creates enough files in the root directory that it is
+   converted to the hashed format and its hash table then
+   doubles, giving each file a distinct size.  Then checks that
+   every name still finds its own file, that names never created
+   are not found, and that removing half of the files leaves the
+   other half intact. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 200
+
+/* Checks that the file numbered I can be opened and has size I. */
+static void
+check_present (int i) 
+{
+  char name[16];
+  int fd, size;
+
+  snprintf (name, sizeof name, "file%d", i);
+  fd = open (name);
+  if (fd < 2)
+    fail ("open \"%s\" failed", name);
+  size = filesize (fd);
+  if (size != i)
+    fail ("\"%s\" has size %d, expected %d", name, size, i);
+  close (fd);
+}
+
+/* Checks that the file numbered I cannot be opened. */
+static void
+check_absent (int i) 
+{
+  char name[16];
+  int fd;
+
+  snprintf (name, sizeof name, "file%d", i);
+  fd = open (name);
+  if (fd != -1)
+    fail ("open \"%s\" returned %d, expected failure", name, fd);
+}
+
+void
+test_main (void) 
+{
+  int i;
+
+  msg ("creating file0 through file%d...", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "file%d", i);
+      if (!create (name, i))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("opening file0 through file%d...", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    check_present (i);
+  for (i = FILE_CNT; i < FILE_CNT + 10; i++)
+    check_absent (i);
+  CHECK (!create ("file7", 0), "create \"file7\" again (must fail)");
+
+  msg ("removing even-numbered files...");
+  for (i = 0; i < FILE_CNT; i += 2) 
+    {
+      char name[16];
+      snprintf (name, sizeof name, "file%d", i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+
+  msg ("opening file0 through file%d again...", FILE_CNT - 1);
+  for (i = 0; i < FILE_CNT; i++)
+    if (i % 2 == 0)
+      check_absent (i);
+    else
+      check_present (i);
+}
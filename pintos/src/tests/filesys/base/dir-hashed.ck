@@ -0,0 +1,14 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-hashed) begin
+(dir-hashed) creating file0 through file199...
+(dir-hashed) opening file0 through file199...
+(dir-hashed) create "file7" again (must fail)
+(dir-hashed) removing even-numbered files...
+(dir-hashed) opening file0 through file199 again...
+(dir-hashed) end
+EOF
+pass;
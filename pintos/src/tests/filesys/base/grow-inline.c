@@ -0,0 +1,62 @@
+/* Writes a file small enough for its data to be stored in its
+   inode, grows it past the inline limit so that it moves to data
+   sectors, then rewrites a range that straddles the old limit,
+   checking the contents after each step. */
+
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define INLINE_SIZE 400         /* Below the 488-byte inline limit. */
+#define FILE_SIZE 1200          /* Well past it. */
+#define REWRITE_OFS 100         /* Rewritten range, across the limit. */
+#define REWRITE_SIZE 600
+
+static char buf[FILE_SIZE];
+
+/* Fills BUF[START] through BUF[START + CNT - 1] with letters
+   starting at BASE. */
+static void
+fill (size_t start, size_t cnt, char base)
+{
+  size_t i;
+
+  for (i = start; i < start + cnt; i++)
+    buf[i] = base + i % 26;
+}
+
+/* Writes BUF[OFS] through BUF[OFS + CNT - 1] to FD at OFS. */
+static void
+write_at (int fd, size_t ofs, size_t cnt)
+{
+  seek (fd, ofs);
+  if (write (fd, buf + ofs, cnt) != (int) cnt)
+    fail ("write %zu bytes at offset %zu in \"inline\" failed", cnt, ofs);
+}
+
+void
+test_main (void) 
+{
+  int fd;
+
+  CHECK (create ("inline", 0), "create \"inline\"");
+  CHECK ((fd = open ("inline")) > 1, "open \"inline\"");
+
+  msg ("write %d bytes", INLINE_SIZE);
+  fill (0, FILE_SIZE, 'a');
+  write_at (fd, 0, INLINE_SIZE);
+  check_file ("inline", buf, INLINE_SIZE);
+
+  msg ("grow to %d bytes", FILE_SIZE);
+  write_at (fd, INLINE_SIZE, FILE_SIZE - INLINE_SIZE);
+  check_file ("inline", buf, FILE_SIZE);
+
+  msg ("rewrite bytes %d through %d", REWRITE_OFS,
+       REWRITE_OFS + REWRITE_SIZE - 1);
+  fill (REWRITE_OFS, REWRITE_SIZE, 'A');
+  write_at (fd, REWRITE_OFS, REWRITE_SIZE);
+  check_file ("inline", buf, FILE_SIZE);
+
+  msg ("close \"inline\"");
+  close (fd);
+}
@@ -38,8 +38,12 @@
 #include "tests/threads/tests.h"
 #endif
 #ifdef FILESYS
+#include "devices/ahci.h"
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/ramdisk.h"
+#include "devices/virtio-blk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -137,9 +141,15 @@ int pintos_init (void) NO_RETURN;
 #ifdef FILESYS
   /* Initialize file system. */
   ide_init ();
+  ahci_init ();
+  virtio_blk_init ();
+  ramdisk_init ();
   locate_block_devices ();
   swap_init ();
   filesys_init (format_filesys);
+#ifdef VM
+  frame_pageout_init ();
+#endif
 #endif
 
   printf ("Boot complete.\n");
@@ -275,6 +285,14 @@ parse_options (char **argv)
         filesys_bdev_name = value;
       else if (!strcmp (name, "-scratch"))
         scratch_bdev_name = value;
+      else if (!strcmp (name, "-fs-cache"))
+        cache_configure (atoi (value));
+      else if (!strcmp (name, "-ramdisk"))
+        ramdisk_configure (value);
+      else if (!strcmp (name, "-ide-large"))
+        ide_allow_large_disks ();
+      else if (!strcmp (name, "-ahci"))
+        ahci_configure (value != NULL ? atoi (value) : 0);
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
@@ -287,6 +305,10 @@ parse_options (char **argv)
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
+#endif
+#ifdef VM
+      else if (!strcmp (name, "-vm-policy"))
+        frame_set_policy (value);
 #endif
     else
       PANIC ("unknown option `%s' (use -h for help)", name);
@@ -401,6 +423,16 @@ usage (void)
           "  -f                 Format file system device during startup.\n"
           "  -filesys=BDEV      Use BDEV for file system instead of default.\n"
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
+          "  -fs-cache=SECTORS  Size the file system buffer cache.\n"
+          "  -ramdisk=ROLE:SIZE[:BDEV]\n"
+          "                     Use a RAM disk of SIZE bytes (K or M suffix)\n"
+          "                     for ROLE, preloaded from a ustar archive on\n"
+          "                     BDEV if given.\n"
+          "  -ide-large         Use IDE disks of 1 GB and larger too.  A file\n"
+          "                     system disk needs 256 kB of kernel memory per\n"
+          "                     GB for its free map.\n"
+          "  -ahci[=DEPTH]      Use AHCI disks, keeping at most DEPTH commands\n"
+          "                     in flight per disk (default 32).\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
 #endif
@@ -409,6 +441,10 @@ usage (void)
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+          "  -vm-policy=POLICY  Replace pages with POLICY: clock (default),\n"
+          "                     eclock, wsclock or 2q.\n"
 #endif
   );
   shutdown_power_off ();
@@ -428,8 +464,8 @@ locate_block_devices (void)
 
 /* Figures out what block device to use for the given ROLE: the
    block device with the given NAME, if NAME is non-null,
-   otherwise the first block device in probe order of type
-   ROLE. */
+   otherwise the RAM disk configured for ROLE, if any, otherwise
+   the first block device in probe order of type ROLE. */
 static void
 locate_block_device (enum block_type role, const char *name)
 {
@@ -441,7 +477,7 @@ locate_block_device (enum block_type role, const char *name)
       if (block == NULL)
         PANIC ("No such block device \"%s\"", name);
     }
-  else
+  else if ((block = ramdisk_get (role)) == NULL)
     {
       for (block = block_first (); block != NULL; block = block_next (block))
         if (block_type (block) == role)
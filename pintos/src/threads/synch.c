@@ -432,13 +432,88 @@ cond_broadcast (struct condition *cond, struct lock *lock)
         cond_signal(cond, lock);
 }
 
-/* Compare priority between semaphores */
+/* Compare priority between semaphores.  A waiter that has not
+   yet blocked on its semaphore ranks lowest. */
 bool
 great_priority_semaphore (const struct list_elem *x, const struct list_elem *y, void * aux UNUSED)
 {
     struct semaphore_elem *semaphore_elem_x = list_entry (x, struct semaphore_elem, elem);
     struct semaphore_elem *semaphore_elem_y = list_entry (y, struct semaphore_elem, elem);
+    if (list_empty (&semaphore_elem_x->semaphore.waiters))
+        return false;
+    if (list_empty (&semaphore_elem_y->semaphore.waiters))
+        return true;
     struct thread *thread_x = list_entry (list_front (&semaphore_elem_x->semaphore.waiters), struct thread, elem);
     struct thread *thread_y = list_entry (list_front (&semaphore_elem_y->semaphore.waiters), struct thread, elem);
     return thread_x->priority > thread_y->priority;
-}
\ No newline at end of file
+}
+
+/* Initializes RW, a readers-writer lock.  Any number of readers
+   may hold RW at once, or one writer, but not both.  Once a
+   writer is waiting, new readers wait behind it, so that a steady
+   stream of readers cannot starve writers.  The lock is not
+   recursive: a thread must not acquire RW in either mode while
+   already holding it. */
+void
+rw_lock_init (struct rw_lock *rw)
+{
+    ASSERT (rw != NULL);
+
+    lock_init (&rw->lock);
+    cond_init (&rw->readers);
+    cond_init (&rw->writers);
+    rw->reader_cnt = 0;
+    rw->writer_wait_cnt = 0;
+    rw->writer = NULL;
+}
+
+/* Acquires RW for reading, sleeping until no writer holds it or
+   waits for it. */
+void
+rw_lock_acquire_read (struct rw_lock *rw)
+{
+    lock_acquire (&rw->lock);
+    while (rw->writer != NULL || rw->writer_wait_cnt > 0)
+        cond_wait (&rw->readers, &rw->lock);
+    rw->reader_cnt++;
+    lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for reading. */
+void
+rw_lock_release_read (struct rw_lock *rw)
+{
+    lock_acquire (&rw->lock);
+    ASSERT (rw->reader_cnt > 0);
+    if (--rw->reader_cnt == 0)
+        cond_signal (&rw->writers, &rw->lock);
+    lock_release (&rw->lock);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it. */
+void
+rw_lock_acquire_write (struct rw_lock *rw)
+{
+    lock_acquire (&rw->lock);
+    rw->writer_wait_cnt++;
+    while (rw->writer != NULL || rw->reader_cnt > 0)
+        cond_wait (&rw->writers, &rw->lock);
+    rw->writer_wait_cnt--;
+    rw->writer = thread_current ();
+    lock_release (&rw->lock);
+}
+
+/* Releases RW, which the current thread holds for writing. */
+void
+rw_lock_release_write (struct rw_lock *rw)
+{
+    lock_acquire (&rw->lock);
+    ASSERT (rw->writer == thread_current ());
+    rw->writer = NULL;
+    if (rw->writer_wait_cnt > 0)
+        cond_signal (&rw->writers, &rw->lock);
+    else
+        cond_broadcast (&rw->readers, &rw->lock);
+    lock_release (&rw->lock);
+}
@@ -47,6 +47,23 @@ void cond_broadcast (struct condition *, struct lock *);
 
 bool great_priority_semaphore (const struct list_elem *, const struct list_elem *, void * aux);
 
+/* Readers-writer lock. */
+struct rw_lock
+{
+    struct lock lock;           /* Protects the members below. */
+    struct condition readers;   /* Signaled when readers may enter. */
+    struct condition writers;   /* Signaled when a writer may enter. */
+    int reader_cnt;             /* Readers holding the lock. */
+    int writer_wait_cnt;        /* Writers waiting for the lock. */
+    struct thread *writer;      /* Writer holding the lock, if any. */
+};
+
+void rw_lock_init (struct rw_lock *);
+void rw_lock_acquire_read (struct rw_lock *);
+void rw_lock_release_read (struct rw_lock *);
+void rw_lock_acquire_write (struct rw_lock *);
+void rw_lock_release_write (struct rw_lock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -205,6 +205,20 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Clears the accessed bit in the PTE for virtual page VPAGE in
+   PD and returns its old value, with a single page table walk.
+   Returns false if PD contains no PTE for VPAGE. */
+bool
+pagedir_test_and_clear_accessed (uint32_t *pd, const void *vpage)
+{
+  uint32_t *pte = lookup_page (pd, vpage, false);
+  if (pte == NULL || (*pte & PTE_A) == 0)
+    return false;
+  *pte &= ~(uint32_t) PTE_A;
+  invalidate_pagedir (pd);
+  return true;
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
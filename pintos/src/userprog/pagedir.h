@@ -13,6 +13,7 @@ bool pagedir_is_dirty (uint32_t *pd, const void *upage);
 void pagedir_set_dirty (uint32_t *pd, const void *upage, bool dirty);
 bool pagedir_is_accessed (uint32_t *pd, const void *upage);
 void pagedir_set_accessed (uint32_t *pd, const void *upage, bool accessed);
+bool pagedir_test_and_clear_accessed (uint32_t *pd, const void *upage);
 void pagedir_activate (uint32_t *pd);
 
 #endif /* userprog/pagedir.h */
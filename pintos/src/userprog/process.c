@@ -311,7 +311,6 @@ load(char *file_name, void (**eip) (void), void **esp)
         goto done;
     process_activate ();
 
-    lock_acquire(&filesystem_lock);
     /* Open executable file. */
     file=filesys_open(argv[0]);
 
@@ -409,7 +408,6 @@ load(char *file_name, void (**eip) (void), void **esp)
     done:
     /* We arrive here whether the load is successful or not. */
     // file_close (file);
-    lock_release (&filesystem_lock);
     return success;
 }
 
@@ -584,9 +582,7 @@ remove_mapid (struct list *mmap_list, int remove_id)
             free (me);
         }
     }
-    lock_acquire (&filesystem_lock);
     file_close(remove_file);
-    lock_release (&filesystem_lock);
 }
 
 static void
@@ -594,10 +590,9 @@ clear_mmap_entry (struct list_elem *e)
 {
     uint32_t *pgdir = thread_current ()->pagedir;
 
-    lock_acquire (&filesystem_lock);
-
     struct mmap_entry *me = list_entry(e, struct mmap_entry, elem);
     me->spte->pinned = true;
+    frame_wait (me->spte);
 
     if (me->spte->is_present)
     {
@@ -609,6 +604,4 @@ clear_mmap_entry (struct list_elem *e)
 
     spt_remove (me->spte);
     list_remove (e);
-
-    lock_release (&filesystem_lock);
 }
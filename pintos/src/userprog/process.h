@@ -9,8 +9,6 @@ struct proc_init{
     bool success;
 };
 
-extern struct lock filesystem_lock;
-
 tid_t process_execute (const char *file_name);
 int process_wait (tid_t);
 void process_exit (void);
@@ -41,8 +41,6 @@ static void sys_halt(void);
 static int sys_mmap(int fd, void *addr);
 static void sys_munmap(int map);
 
-struct lock filesystem_lock;
-
 static struct spt_entry *
 check_and_pin_addr(void *addr, void *esp)
 {
@@ -128,7 +126,6 @@ valid_uaddr(const void * uaddr, unsigned int len)
 void syscall_init(void)
 {
     intr_register_int(0x30, 3, INTR_ON, syscall_handler, "syscall");
-    lock_init(&filesystem_lock);
 }
 
 static void
@@ -270,10 +267,7 @@ sys_create(const char *file, unsigned initial_size)
     valid_string(file);
 
     /* Call filesys */
-    lock_acquire(&filesystem_lock);
-    bool success= filesys_create(file, initial_size);
-    lock_release(&filesystem_lock);
-    return success;
+    return filesys_create(file, initial_size);
 }
 
 static bool
@@ -282,10 +276,7 @@ sys_remove(const char *file)
     /* Check file name */
     valid_string(file);
 
-    lock_acquire(&filesystem_lock);
-    bool success = filesys_remove(file);
-    lock_release(&filesystem_lock);
-    return success;
+    return filesys_remove(file);
 }
 
 static int
@@ -293,20 +284,15 @@ sys_open(const char *file)
 {
     valid_string(file);
 
-    lock_acquire(&filesystem_lock);
     struct file *fo = filesys_open(file);
     if (!fo)
-    {
-        lock_release(&filesystem_lock);
         return -1;
-    }
     struct file_descriptor *fd_s = malloc(sizeof(struct file_descriptor));
 
     fd_s->fd=thread_current()->fd_index++;
     fd_s->file_pointer = fo;
     strlcpy(fd_s->name, file, strlen(file));
     list_push_back(&thread_current()->file_descriptors, &fd_s->elem);
-    lock_release(&filesystem_lock);
     return fd_s->fd;
 
 }
@@ -320,13 +306,9 @@ sys_close(int fd)
     if (!fd_s)
         sys_exit(-1);
 
-    lock_acquire(&filesystem_lock);
-
     file_close(fd_s->file_pointer);
     list_remove(&fd_s->elem);
     free(fd_s);
-
-    lock_release(&filesystem_lock);
 }
 
 void sys_exit(int status)
@@ -351,10 +333,8 @@ void sys_exit(int status)
 static int
 sys_write(int fd, const void *buffer, unsigned size)
 {
-    lock_acquire(&filesystem_lock);
     if(fd == 0)
     {
-        lock_release(&filesystem_lock);
         sys_exit(-1);
         return -1;
     }
@@ -362,27 +342,20 @@ sys_write(int fd, const void *buffer, unsigned size)
     {
         /* Write to the Console*/
         putbuf((const char *)buffer, size);
-        lock_release(&filesystem_lock);
         return size;
     }
     else
     {
         struct file_descriptor *fd_s = get_fdstruct(fd);
         if (!fd_s)
-        {
-            lock_release(&filesystem_lock);
             return -1;
-        }
-        int r = file_write(fd_s->file_pointer, buffer, size);
-        lock_release(&filesystem_lock);
-        return r;
+        return file_write(fd_s->file_pointer, buffer, size);
     }
 }
 
 static int
 sys_read(int fd, void *buffer, unsigned size)
 {
-    lock_acquire(&filesystem_lock);
     if(fd == 0)
     {
         input_getc();
@@ -390,7 +363,6 @@ sys_read(int fd, void *buffer, unsigned size)
     }
     else if (fd == 1)
     {
-        lock_release(&filesystem_lock);
         sys_exit(-1);
         return -1;
     }
@@ -398,13 +370,8 @@ sys_read(int fd, void *buffer, unsigned size)
     {
         struct file_descriptor *fd_s = get_fdstruct(fd);
         if(!fd_s)
-        {
-            lock_release(&filesystem_lock);
             return -1;
-        }
-        int bytes= file_read(fd_s->file_pointer, buffer, size);
-        lock_release(&filesystem_lock);
-        return bytes;
+        return file_read(fd_s->file_pointer, buffer, size);
     }
 }
 
@@ -414,10 +381,7 @@ sys_filesize(int fd)
     struct file_descriptor *fd_s = get_fdstruct(fd);
     if(!fd_s)
         return -1;
-    lock_acquire(&filesystem_lock);
-    int r = file_length(fd_s->file_pointer);
-    lock_release(&filesystem_lock);
-    return r;
+    return file_length(fd_s->file_pointer);
 }
 
 static pid_t
@@ -439,9 +403,7 @@ sys_seek(int fd, unsigned position)
     struct file_descriptor *fd_s=get_fdstruct(fd);
     if (!fd_s)
         return;
-    lock_acquire(&filesystem_lock);
     file_seek(fd_s->file_pointer, position);
-    lock_release(&filesystem_lock);
 }
 
 static unsigned
@@ -450,10 +412,7 @@ sys_tell(int fd)
     struct file_descriptor *fd_s = get_fdstruct(fd);
     if (!fd_s)
         return -1;
-    lock_acquire(&filesystem_lock);
-    unsigned pos = file_tell(fd_s->file_pointer);
-    lock_release(&filesystem_lock);
-    return pos;
+    return file_tell(fd_s->file_pointer);
 }
 
 static void
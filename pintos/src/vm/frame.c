@@ -1,4 +1,5 @@
 #include "vm/frame.h"
+#include <string.h>
 #include "threads/palloc.h"
 #include "threads/malloc.h"
 #include "threads/thread.h"
@@ -8,41 +9,214 @@
 #include "vm/swap.h"
 #include <stdio.h>
 
+/* A page replacement policy.  Its functions are called with
+   frame_table_lock held.  VICTIM returns a null pointer if no
+   frame can be evicted, because all are pinned or busy. */
+struct frame_policy
+{
+    const char *name;                           /* Name for -vm-policy. */
+    void (*init) (void);                        /* Sets up, at boot. */
+    void (*add) (struct frame_entry *);         /* Frame got a page. */
+    void (*remove) (struct frame_entry *);      /* Frame freed. */
+    void (*forget) (struct spt_entry *);        /* Page gone; optional. */
+    struct frame_entry *(*victim) (void);       /* Picks, removes victim. */
+    void (*print_stats) (void);                 /* Optional. */
+};
+
+static const struct frame_policy *policy;
+
+static size_t frame_base;   /* Physical page number of frame_table[0]. */
+
+static size_t free_frame_cnt; /* Frames in the user pool not in use. */
+
+/* Page-out daemon.  It is woken when fewer than pageout_low
+   frames are free and frees frames until pageout_high are.  The
+   watermarks are about 3% and 6% of the user pool. */
+static size_t pageout_low, pageout_high;
+static struct semaphore pageout_sema;
+static bool pageout_pending;    /* Woken, not yet done? */
+
+static void frame_evict (struct frame_entry *, enum palloc_flags);
+static void readahead_settle (struct frame_entry *);
+
+/* Statistics. */
+static long long fault_cnt;     /* Pages brought into frames. */
+static long long hit_cnt;       /* References seen by the policy. */
+static long long evict_cnt;     /* Pages evicted. */
+static long long write_cnt;     /* Evicted pages written out. */
+static long long direct_cnt;    /* Evictions by faulting threads. */
+static long long pageout_cnt;   /* Frames freed by the daemon. */
+static long long pageout_run_cnt; /* Times the daemon ran. */
+static long long readahead_cnt; /* Pages read around a swap-in fault. */
+static long long readahead_hit_cnt;  /* ...then referenced. */
+static long long readahead_miss_cnt; /* ...then dropped unreferenced. */
+
+/* Returns the index in frame_table of the frame at kernel
+   virtual address FRAME. */
+static size_t
+frame_index (void *frame)
+{
+    size_t idx = (vtop (frame) >> PGBITS) - frame_base;
+    ASSERT (idx < frame_cnt);
+    return idx;
+}
 
 void
 frame_table_init(void)
 {
+    uint8_t *base = palloc_user_pool (&frame_cnt);
+    size_t i;
+
     lock_init(&frame_table_lock);
-    list_init(&frame_table);
-    frame_table_index=malloc(sizeof(struct frame_entry *) * init_ram_pages);
+    frame_table = malloc (sizeof *frame_table * frame_cnt);
+    if (frame_table == NULL && frame_cnt > 0)
+        PANIC ("frame table allocation failed");
+    frame_base = vtop (base) >> PGBITS;
+    for (i = 0; i < frame_cnt; i++)
+    {
+        frame_table[i].frame_addr = base + i * PGSIZE;
+        frame_table[i].owner_thread = NULL;
+        frame_table[i].spte = NULL;
+        frame_table[i].state = FRAME_FREE;
+        frame_table[i].prefetched = false;
+        lock_init (&frame_table[i].lock);
+    }
+    free_frame_cnt = frame_cnt;
+    pageout_low = frame_cnt / 32 + 1;
+    pageout_high = frame_cnt / 16 + 2;
+    sema_init (&pageout_sema, 0);
+    if (policy == NULL)
+        frame_set_policy ("clock");
+    policy->init ();
 }
 
 void *
 frame_get(struct spt_entry *spte, bool ZERO)
 {
+    enum palloc_flags flags = ZERO ? PAL_USER | PAL_ZERO : PAL_USER;
+    struct frame_entry *fe;
+    bool evicted = false;
+    void *addr;
+
     lock_acquire(&frame_table_lock);
 
-    void *addr=palloc_get_page(ZERO ? PAL_USER | PAL_ZERO : PAL_USER);
+    for (;;)
+    {
+        addr=palloc_get_page(flags);
+        if(addr!=NULL)
+        {
+            fe=&frame_table[frame_index (addr)];
+            free_frame_cnt--;
+            break;
+        }
+        fe=policy->victim ();
+        if(fe!=NULL)
+        {
+            frame_evict(fe, flags);
+            evicted=true;
+            direct_cnt++;
+            break;
+        }
+
+        /* Every frame is pinned, loading or being evicted.  Let
+           the threads using them go on. */
+        lock_release(&frame_table_lock);
+        thread_yield ();
+        lock_acquire(&frame_table_lock);
+    }
 
-    while(addr==NULL)
-        addr=frame_evict(ZERO ? PAL_USER | PAL_ZERO : PAL_USER);
+    fe->owner_thread=thread_current();
+    fe->spte=spte;
+    fe->state=FRAME_LOADING;
+    fe->prefetched=false;
+    spte->frame=fe;
+    fault_cnt++;
+    policy->add (fe);
 
-    if(addr!=NULL)
+    if (free_frame_cnt < pageout_low && !pageout_pending)
     {
-        struct frame_entry *fe=malloc(sizeof(struct frame_entry));
-        fe->frame_addr=addr;
+        pageout_pending = true;
+        sema_up (&pageout_sema);
+    }
+
+    lock_release(&frame_table_lock);
+    if (evicted)
+        lock_release (&fe->lock);
+    return fe->frame_addr;
+}
+
+/* Like frame_get(), for a page read speculatively around a
+   swap-in fault: takes only a free frame, and only if that does
+   not bring the free frames below the page-out daemon's low
+   watermark, so that read-around never evicts a page.  Returns a
+   null pointer if there is no such frame or SPTE's page is still
+   in a frame. */
+void *
+frame_get_readahead (struct spt_entry *spte)
+{
+    struct frame_entry *fe;
+    void *addr = NULL;
+
+    lock_acquire(&frame_table_lock);
+    if (spte->frame == NULL && free_frame_cnt > pageout_low)
+        addr = palloc_get_page (PAL_USER);
+    if (addr != NULL)
+    {
+        fe=&frame_table[frame_index (addr)];
+        free_frame_cnt--;
         fe->owner_thread=thread_current();
         fe->spte=spte;
-        list_push_back(&frame_table,&fe->elem);
+        fe->state=FRAME_LOADING;
+        fe->prefetched=true;
+        spte->frame=fe;
+        readahead_cnt++;
+        policy->add (fe);
+    }
+    lock_release(&frame_table_lock);
+    return addr;
+}
+
+/* Marks FRAME, obtained from frame_get(), as holding its page,
+   installed and loaded, so that it may be evicted. */
+void
+frame_loaded (void *frame)
+{
+    lock_acquire(&frame_table_lock);
+    ASSERT (frame_table[frame_index (frame)].state == FRAME_LOADING);
+    frame_table[frame_index (frame)].state = FRAME_IN_USE;
+    lock_release(&frame_table_lock);
+}
+
+/* Waits until SPTE's page is not being evicted.  Afterward, until
+   SPTE is pinned or loaded again, SPTE->is_present tells whether
+   the page is in a frame. */
+void
+frame_wait (struct spt_entry *spte)
+{
+    struct frame_entry *fe;
 
-        frame_table_index[pg_no (vtop (addr))]=fe;
+    lock_acquire(&frame_table_lock);
+    fe = spte->frame;
+    if (fe != NULL && fe->state == FRAME_EVICTING)
+    {
         lock_release(&frame_table_lock);
+        lock_acquire (&fe->lock);
+        lock_release (&fe->lock);
     }
     else
-    {
-        PANIC("frame not enough");
-    }
-    return addr;
+        lock_release(&frame_table_lock);
+}
+
+/* Tells the policy that SPTE, which is not in a frame, is about
+   to be freed. */
+void
+frame_forget (struct spt_entry *spte)
+{
+    if (policy->forget == NULL)
+        return;
+    lock_acquire(&frame_table_lock);
+    policy->forget (spte);
+    lock_release(&frame_table_lock);
 }
 
 void
@@ -51,71 +225,591 @@ frame_free (void *frame)
     if(frame == NULL) return;
     lock_acquire(&frame_table_lock);
 
-    intptr_t frame_pgno=pg_no(vtop(frame));
+    struct frame_entry *fe=&frame_table[frame_index (frame)];
 
-    if(frame_table_index [frame_pgno] == NULL)
-    {
+    if(fe->spte == NULL)
         PANIC ("frame to free not exist");
+    ASSERT (fe->state != FRAME_EVICTING);
+    readahead_settle (fe);
+    policy->remove (fe);
+    fe->spte->frame=NULL;
+    fe->spte=NULL;
+    fe->owner_thread=NULL;
+    fe->state=FRAME_FREE;
+    palloc_free_page(frame);
+    free_frame_cnt++;
+
+    lock_release(&frame_table_lock);
+}
+
+/* Eviction is done in three steps, so that the page-out daemon
+   can write several pages at once.  evict_begin() and evict_end()
+   are called with frame_table_lock held, evict_write() without it.
+   Between them the frame is FRAME_EVICTING and its own lock is
+   held, so that its page's owner waits in frame_wait() if it
+   faults on the page, while faults that need no eviction, or
+   evict other frames, go on. */
+
+/* Starts evicting the page in FE, a victim chosen by the policy:
+   unmaps it and returns whether it was dirty. */
+static bool
+evict_begin (struct frame_entry *fe)
+{
+    uint32_t *pd=fe->owner_thread->pagedir;
+    void *upage=fe->spte->addr;
+
+    fe->state = FRAME_EVICTING;
+    lock_acquire (&fe->lock);
+    readahead_settle (fe);
+    pagedir_clear_page(pd,upage);
+    return pagedir_is_dirty (pd, upage);
+}
+
+/* Writes back the pages in the CNT frames in FES, whose dirty
+   bits are in DIRTY, where they need it.  Pages bound for swap
+   go out together, to consecutive slots if possible. */
+static void
+evict_write (struct frame_entry **fes, const bool *dirty, size_t cnt)
+{
+    void *frames[SWAP_CLUSTER];
+    struct spt_entry *sptes[SWAP_CLUSTER];
+    size_t swap_cnt = 0;
+    size_t i;
+
+    ASSERT (cnt <= SWAP_CLUSTER);
+    for (i = 0; i < cnt; i++)
+    {
+        struct spt_entry *spte = fes[i]->spte;
+
+        if(spte->type==PAGE_MMAP)
+        {
+            if (dirty[i])
+                file_write_at (spte->file, fes[i]->frame_addr, spte->read_bytes, spte->ofs);
+            continue;
+        }
+        if (spte->type == PAGE_ELF)
+        {
+            if (!dirty[i])
+                continue;
+            spte->type=PAGE_SWAP;
+        }
+        frames[swap_cnt] = fes[i]->frame_addr;
+        sptes[swap_cnt++] = spte;
+    }
+    if (swap_cnt > 0)
+        swap_dump_cluster (frames, sptes, swap_cnt);
+}
+
+/* Finishes evicting the page in FE, which was DIRTY, leaving the
+   frame empty but allocated and its lock still held. */
+static void
+evict_end (struct frame_entry *fe, bool dirty)
+{
+    struct spt_entry *spte = fe->spte;
+
+    spte->is_present = false;
+    spte->frame = NULL;
+    fe->spte = NULL;
+    fe->owner_thread = NULL;
+    evict_cnt++;
+    if (dirty || spte->type == PAGE_SWAP)
+        write_cnt++;
+}
+
+/* Evicts the page in FE, a victim chosen by the policy, and
+   leaves the frame empty but allocated, ready for reuse with
+   FLAGS.  Must be called with frame_table_lock held, which is
+   released while the page is written.  Returns with it held
+   again and the frame's lock still held. */
+static void
+frame_evict(struct frame_entry *fe, enum palloc_flags flags)
+{
+    bool dirty = evict_begin (fe);
+
+    lock_release(&frame_table_lock);
+    evict_write (&fe, &dirty, 1);
+    if (flags & PAL_ZERO)
+        memset (fe->frame_addr, 0, PGSIZE);
+    lock_acquire(&frame_table_lock);
+    evict_end (fe, dirty);
+}
+
+/* Page-out daemon.  Sleeps until frame_get() leaves fewer than
+   pageout_low free frames, then evicts pages, writing back those
+   that need it, and frees their frames until pageout_high are
+   free, so that later faults find a free frame
+   instead of paying for an eviction themselves.  It takes up to
+   SWAP_CLUSTER victims at a time, so that anonymous pages evicted
+   together are written to swap together. */
+static void
+pageout_daemon (void *aux UNUSED)
+{
+    for (;;)
+    {
+        sema_down (&pageout_sema);
+
+        lock_acquire(&frame_table_lock);
+        pageout_run_cnt++;
+        while (free_frame_cnt < pageout_high)
+        {
+            struct frame_entry *fes[SWAP_CLUSTER];
+            bool dirty[SWAP_CLUSTER];
+            size_t cnt = 0;
+            size_t i;
+
+            while (cnt < SWAP_CLUSTER
+                   && free_frame_cnt + cnt < pageout_high)
+            {
+                struct frame_entry *fe = policy->victim ();
+                if (fe == NULL)
+                    break;
+                dirty[cnt] = evict_begin (fe);
+                fes[cnt++] = fe;
+            }
+            if (cnt == 0)
+                break;
+
+            lock_release(&frame_table_lock);
+            evict_write (fes, dirty, cnt);
+            lock_acquire(&frame_table_lock);
+
+            for (i = 0; i < cnt; i++)
+            {
+                evict_end (fes[i], dirty[i]);
+                fes[i]->state = FRAME_FREE;
+                palloc_free_page (fes[i]->frame_addr);
+                free_frame_cnt++;
+                pageout_cnt++;
+                lock_release (&fes[i]->lock);
+            }
+        }
+        pageout_pending = false;
+        lock_release(&frame_table_lock);
+    }
+}
+
+/* Starts the page-out daemon.  Must be called once the swap
+   device is ready. */
+void
+frame_pageout_init (void)
+{
+    thread_create ("pageout", PRI_DEFAULT, pageout_daemon, NULL);
+}
+
+/* Prints frame statistics. */
+void
+frame_print_stats (void)
+{
+    printf ("Frames: %zu, policy %s: %lld faults, %lld hits, "
+            "%lld evictions, %lld written\n",
+            frame_cnt, policy->name, fault_cnt, hit_cnt, evict_cnt,
+            write_cnt);
+    if (policy->print_stats != NULL)
+        policy->print_stats ();
+    printf ("Page-out: %lld frames freed in %lld runs, "
+            "%lld evictions by faulting threads\n",
+            pageout_cnt, pageout_run_cnt, direct_cnt);
+    printf ("Read-around: %lld pages, %lld hits, %lld misses\n",
+            readahead_cnt, readahead_hit_cnt, readahead_miss_cnt);
+}
+
+/* Helpers for policies. */
+
+/* Returns true if FE holds a page that may be evicted. */
+static bool
+frame_evictable (const struct frame_entry *fe)
+{
+    return fe->state == FRAME_IN_USE && !fe->spte->pinned;
+}
+
+/* Returns true if FE's page has been referenced since the last
+   call, counting a hit if so. */
+static bool
+frame_referenced (struct frame_entry *fe)
+{
+    if (!pagedir_test_and_clear_accessed (fe->owner_thread->pagedir,
+                                          fe->spte->addr))
+        return false;
+    if (fe->prefetched)
+    {
+        fe->prefetched = false;
+        readahead_hit_cnt++;
     }
+    hit_cnt++;
+    return true;
+}
+
+/* If FE's page was read around a fault and has not been found
+   referenced yet, counts a read-around hit or miss, by whether
+   it has been referenced now.  Called when the page leaves the
+   frame. */
+static void
+readahead_settle (struct frame_entry *fe)
+{
+    if (!fe->prefetched)
+        return;
+    fe->prefetched = false;
+    if (pagedir_is_accessed (fe->owner_thread->pagedir, fe->spte->addr))
+        readahead_hit_cnt++;
     else
+        readahead_miss_cnt++;
+}
+
+/* Returns true if evicting FE's page would have to write it out.
+   Anonymous pages are always written to swap. */
+static bool
+frame_dirty (const struct frame_entry *fe)
+{
+    return (fe->spte->type == PAGE_SWAP
+            || pagedir_is_dirty (fe->owner_thread->pagedir, fe->spte->addr));
+}
+
+static void
+policy_nop (struct frame_entry *fe UNUSED)
+{
+}
+
+/* Clock.  The hand sweeps the frame table in order and stays
+   where it stopped, so every frame gets the same second chance
+   and each victim costs O(1) steps over many evictions. */
+
+static size_t clock_hand;       /* Next frame the hand looks at. */
+
+static void
+clock_init (void)
+{
+    clock_hand = 0;
+}
+
+/* Returns the frame under the hand and moves the hand on. */
+static struct frame_entry *
+clock_advance (void)
+{
+    struct frame_entry *fe = &frame_table[clock_hand];
+    clock_hand = (clock_hand + 1) % frame_cnt;
+    return fe;
+}
+
+static struct frame_entry *
+clock_victim (void)
+{
+    size_t i;
+
+    for (i = 0; i < 2 * frame_cnt; i++)
     {
-        struct frame_entry *fe=frame_table_index[frame_pgno];
-        list_remove(&fe->elem);
-        palloc_free_page(frame);
-        free(fe);
-        frame_table_index[frame_pgno]=NULL;
+        struct frame_entry *fe = clock_advance ();
+        if (frame_evictable (fe) && !frame_referenced (fe))
+            return fe;
     }
-    lock_release(&frame_table_lock);
+    return NULL;
 }
 
-//second chance algorithm
-void *
-frame_evict(enum palloc_flags flags)
+static const struct frame_policy clock_policy =
 {
-    for(; ;)
+    "clock", clock_init, policy_nop, policy_nop, NULL, clock_victim, NULL
+};
+
+/* Enhanced clock.  Prefers pages that are neither referenced nor
+   dirty, which can be dropped without a write: first sweeps once
+   for one without touching the reference bits, then sweeps as the
+   plain clock does, accepting a dirty page. */
+
+static struct frame_entry *
+eclock_victim (void)
+{
+    int round;
+
+    for (round = 0; round < 2; round++)
     {
-        struct list_elem *e=list_begin(&frame_table);
-        for(e = list_begin(&frame_table); e != list_end(&frame_table); e = list_next (e))
+        size_t i;
+
+        for (i = 0; i < frame_cnt; i++)
+        {
+            struct frame_entry *fe = clock_advance ();
+            if (frame_evictable (fe)
+                && !pagedir_is_accessed (fe->owner_thread->pagedir,
+                                         fe->spte->addr)
+                && !frame_dirty (fe))
+                return fe;
+        }
+        for (i = 0; i < frame_cnt; i++)
         {
-            struct frame_entry *fe = list_entry(e,struct frame_entry,elem);
-            if(!fe->spte->pinned)
+            struct frame_entry *fe = clock_advance ();
+            if (frame_evictable (fe) && !frame_referenced (fe))
+                return fe;
+        }
+    }
+    return NULL;
+}
+
+static const struct frame_policy eclock_policy =
+{
+    "eclock", clock_init, policy_nop, policy_nop, NULL, eclock_victim, NULL
+};
+
+/* WSClock.  A page belongs to its process's working set if it
+   was referenced within the last TAU faults, where TAU is half
+   the number of frames.  The hand evicts the first clean page
+   outside the working set.  Pages are written synchronously here,
+   so failing that it takes the first dirty page outside the
+   working set, and failing that the least recently used page. */
+
+static void
+wsclock_add (struct frame_entry *fe)
+{
+    fe->last_use = fault_cnt;
+}
+
+static struct frame_entry *
+wsclock_victim (void)
+{
+    int64_t tau = frame_cnt / 2;
+    int round;
+
+    for (round = 0; round < 2; round++)
+    {
+        struct frame_entry *old_dirty = NULL;
+        struct frame_entry *lru = NULL;
+        size_t i;
+
+        for (i = 0; i < frame_cnt; i++)
+        {
+            struct frame_entry *fe = clock_advance ();
+            if (!frame_evictable (fe))
+                continue;
+            if (frame_referenced (fe))
+                fe->last_use = fault_cnt;
+            else if (fault_cnt - fe->last_use <= tau)
             {
-                uint32_t *pd=fe->owner_thread->pagedir;
-                uint8_t *upage=fe->spte->addr;
-                if(pagedir_is_accessed(pd, upage))
-                    pagedir_set_accessed(pd,upage,false);
-                else
-                {
-                    pagedir_clear_page(pd,upage);
-                    if(fe->spte->type==PAGE_MMAP)
-                    {
-                        if (pagedir_is_dirty (pd, upage))
-                        {
-                            lock_acquire (&filesystem_lock);
-                            file_write_at (fe->spte->file, fe->frame_addr, fe->spte->read_bytes, fe->spte->ofs);
-                            lock_release (&filesystem_lock);
-                        }
-                    }
-                    else if (fe->spte->type == PAGE_SWAP)
-                    {
-                        fe->spte->swap_index=swap_dump(fe->frame_addr);
-                    }
-                    else if (fe->spte->type == PAGE_ELF)
-                    {
-                        if(pagedir_is_dirty(pd,upage))
-                        {
-                            fe->spte->type=PAGE_SWAP;
-                            fe->spte->swap_index=swap_dump(fe->frame_addr);
-                        }
-                    }
-                    fe->spte->is_present = false;
-                    palloc_free_page(fe->frame_addr);
-                    list_remove(&fe->elem);
-                    frame_table_index[pg_no(vtop (fe->frame_addr))] = NULL;
-                    free(fe);
-                    return palloc_get_page(flags);
-                }
+                if (lru == NULL || fe->last_use < lru->last_use)
+                    lru = fe;
             }
+            else if (!frame_dirty (fe))
+                return fe;
+            else if (old_dirty == NULL)
+                old_dirty = fe;
+        }
+        if (old_dirty != NULL)
+            return old_dirty;
+        if (lru != NULL)
+            return lru;
+    }
+    return NULL;
+}
+
+static const struct frame_policy wsclock_policy =
+{
+    "wsclock", clock_init, wsclock_add, policy_nop, NULL, wsclock_victim,
+    NULL
+};
+
+/* 2Q.  A page brought in for the first time joins A1in, a FIFO
+   queue of up to a quarter of the frames, and is evicted from
+   there unless it is faulted in again while its identity is still
+   remembered in A1out, a ring of the last half-frame-count pages
+   evicted from A1in.  Such a page has shown it is reused and joins
+   Am, which is managed as a clock.  Pages are identified by their
+   supplemental page table entries, which are forgotten when the
+   entries are freed. */
+
+/* Remembered page evicted from A1in. */
+struct ghost
+{
+    struct spt_entry *spte;     /* Page, or NULL if slot is empty. */
+    struct hash_elem elem;      /* Element in ghost_hash. */
+};
+
+static struct list a1in, am;    /* A1in and Am queues. */
+static size_t a1in_cnt, am_cnt; /* Frames in each. */
+static size_t a1in_max;         /* Target size of A1in. */
+static struct ghost *ghosts;    /* A1out ring. */
+static size_t ghost_cnt;        /* Slots in ring. */
+static size_t ghost_next;       /* Slot to fill next. */
+static struct hash ghost_hash;  /* Ghosts by page. */
+static long long ghost_hit_cnt; /* Faults on pages in A1out. */
+
+static unsigned
+ghost_hash_func (const struct hash_elem *e, void *aux UNUSED)
+{
+    struct ghost *g = hash_entry (e, struct ghost, elem);
+    return hash_bytes (&g->spte, sizeof g->spte);
+}
+
+static bool
+ghost_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+    return (hash_entry (a, struct ghost, elem)->spte
+            < hash_entry (b, struct ghost, elem)->spte);
+}
+
+static void
+twoq_init (void)
+{
+    list_init (&a1in);
+    list_init (&am);
+    a1in_cnt = am_cnt = 0;
+    a1in_max = frame_cnt / 4 > 0 ? frame_cnt / 4 : 1;
+    ghost_cnt = frame_cnt / 2 > 0 ? frame_cnt / 2 : 1;
+    ghost_next = 0;
+    ghosts = calloc (ghost_cnt, sizeof *ghosts);
+    if (ghosts == NULL
+        || !hash_init (&ghost_hash, ghost_hash_func, ghost_less, NULL))
+        PANIC ("2Q page replacement: out of memory");
+}
+
+/* Remembers SPTE in A1out, forgetting the oldest ghost if the
+   ring is full. */
+static void
+ghost_add (struct spt_entry *spte)
+{
+    struct ghost *g = &ghosts[ghost_next];
+    struct hash_elem *old;
+
+    ghost_next = (ghost_next + 1) % ghost_cnt;
+    if (g->spte != NULL)
+        hash_delete (&ghost_hash, &g->elem);
+    g->spte = spte;
+    old = hash_replace (&ghost_hash, &g->elem);
+    if (old != NULL)
+        hash_entry (old, struct ghost, elem)->spte = NULL;
+}
+
+/* Forgets SPTE if it is in A1out and returns whether it was. */
+static bool
+ghost_remove (struct spt_entry *spte)
+{
+    struct ghost key;
+    struct hash_elem *e;
+
+    key.spte = spte;
+    e = hash_delete (&ghost_hash, &key.elem);
+    if (e == NULL)
+        return false;
+    hash_entry (e, struct ghost, elem)->spte = NULL;
+    return true;
+}
+
+static void
+twoq_add (struct frame_entry *fe)
+{
+    fe->hot = ghost_remove (fe->spte);
+    if (fe->hot)
+    {
+        ghost_hit_cnt++;
+        list_push_back (&am, &fe->elem);
+        am_cnt++;
+    }
+    else
+    {
+        list_push_back (&a1in, &fe->elem);
+        a1in_cnt++;
+    }
+}
+
+static void
+twoq_remove (struct frame_entry *fe)
+{
+    list_remove (&fe->elem);
+    if (fe->hot)
+        am_cnt--;
+    else
+        a1in_cnt--;
+}
+
+/* Forgets SPTE, which is being freed, so that a page allocated
+   later at the same address is not taken for it. */
+static void
+twoq_forget (struct spt_entry *spte)
+{
+    ghost_remove (spte);
+}
+
+/* Takes the oldest evictable frame from A1in and remembers its
+   page in A1out, or returns NULL if there is none. */
+static struct frame_entry *
+twoq_victim_a1in (void)
+{
+    struct list_elem *e;
+
+    for (e = list_begin (&a1in); e != list_end (&a1in); e = list_next (e))
+    {
+        struct frame_entry *fe = list_entry (e, struct frame_entry, elem);
+        if (frame_evictable (fe))
+        {
+            twoq_remove (fe);
+            ghost_add (fe->spte);
+            return fe;
         }
     }
-}
\ No newline at end of file
+    return NULL;
+}
+
+/* Turns Am as a clock, for up to two revolutions, and takes the
+   first evictable frame not referenced, or returns NULL. */
+static struct frame_entry *
+twoq_victim_am (void)
+{
+    size_t i;
+
+    for (i = 0; i < 2 * am_cnt; i++)
+    {
+        struct frame_entry *fe = list_entry (list_pop_front (&am),
+                                             struct frame_entry, elem);
+        if (frame_evictable (fe) && !frame_referenced (fe))
+        {
+            am_cnt--;
+            return fe;
+        }
+        list_push_back (&am, &fe->elem);
+    }
+    return NULL;
+}
+
+static struct frame_entry *
+twoq_victim (void)
+{
+    struct frame_entry *fe = NULL;
+
+    if (a1in_cnt > a1in_max || am_cnt == 0)
+        fe = twoq_victim_a1in ();
+    if (fe == NULL)
+        fe = twoq_victim_am ();
+    if (fe == NULL)
+        fe = twoq_victim_a1in ();
+    return fe;
+}
+
+static void
+twoq_print_stats (void)
+{
+    printf ("2Q: %zu frames in A1in, %zu in Am, %lld faults on A1out\n",
+            a1in_cnt, am_cnt, ghost_hit_cnt);
+}
+
+static const struct frame_policy twoq_policy =
+{
+    "2q", twoq_init, twoq_add, twoq_remove, twoq_forget, twoq_victim,
+    twoq_print_stats
+};
+
+static const struct frame_policy *policies[] =
+{
+    &clock_policy, &eclock_policy, &wsclock_policy, &twoq_policy
+};
+
+/* Selects the replacement policy called NAME.  Must be called
+   before frame_table_init(). */
+void
+frame_set_policy (const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof policies / sizeof *policies; i++)
+        if (!strcmp (name, policies[i]->name))
+        {
+            policy = policies[i];
+            return;
+        }
+    PANIC ("unknown page replacement policy \"%s\"", name);
+}
@@ -4,24 +4,51 @@
 #include <hash.h>
 #include <list.h>
 #include <debug.h>
+#include <stdint.h>
 #include "threads/palloc.h"
 #include "threads/synch.h"
 
+/* States of a frame. */
+enum frame_state
+{
+    FRAME_FREE,                     /* Not allocated. */
+    FRAME_LOADING,                  /* Given out, page not loaded yet. */
+    FRAME_IN_USE,                   /* Holds a page; may be evicted. */
+    FRAME_EVICTING                  /* Its page is being written back. */
+};
+
+/* A frame of the user pool.  The frame table holds one for every
+   frame, preallocated, in physical address order.  The members
+   are protected by frame_table_lock.  LOCK is held by the thread
+   evicting the frame's page for as long as it is FRAME_EVICTING. */
 struct frame_entry
 {
-    void *frame_addr;
+    void *frame_addr;               /* Kernel virtual address. */
     struct thread *owner_thread;
-    struct spt_entry *spte;
-    struct list_elem elem;
+    struct spt_entry *spte;         /* Page held, or NULL if free. */
+    enum frame_state state;
+    struct lock lock;               /* Held during eviction. */
+    bool prefetched;                /* Read around a fault, unused yet? */
+
+    /* Replacement policy state. */
+    struct list_elem elem;          /* 2Q: element in A1in or Am. */
+    bool hot;                       /* 2Q: in Am rather than A1in? */
+    int64_t last_use;               /* WSClock: fault count at last use. */
 };
 
 struct lock frame_table_lock;
-struct frame_entry **frame_table_index;
-struct list frame_table;
+struct frame_entry *frame_table;    /* Indexed by frame_index(). */
+size_t frame_cnt;                   /* Number of entries in frame_table. */
 
+void frame_set_policy (const char *name);
 void frame_table_init (void);
+void frame_pageout_init (void);
 void *frame_get (struct spt_entry *, bool);
+void *frame_get_readahead (struct spt_entry *);
+void frame_loaded (void *);
+void frame_wait (struct spt_entry *);
 void frame_free (void *);
-void *frame_evict (enum palloc_flags);
+void frame_forget (struct spt_entry *);
+void frame_print_stats (void);
 
-#endif
\ No newline at end of file
+#endif
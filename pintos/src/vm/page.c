@@ -35,11 +35,16 @@ static void
 spte_clear(struct hash_elem *e, void *aux UNUSED)
 {
     struct spt_entry *spte=hash_entry(e, struct spt_entry, elem);
+    spte->pinned=true;
+    frame_wait(spte);
     if(spte->is_present)
     {
         frame_free(pagedir_get_page(thread_current()->pagedir,spte->addr));
         pagedir_clear_page(thread_current()->pagedir,spte->addr);
     }
+    else if(spte->type==PAGE_SWAP)
+        swap_free(spte->swap_index);
+    frame_forget(spte);
     free(spte);
 }
 
@@ -70,17 +75,12 @@ spt_load_file(struct spt_entry *spte)
     if(kpage == NULL)
         return false;
 
-    lock_acquire(&filesystem_lock);
-
     if(file_read_at(file,kpage,page_read_bytes,ofs)!=(int) page_read_bytes)
     {
         frame_free(kpage);
-        lock_release(&filesystem_lock);
         return false;
     }
 
-    lock_release(&filesystem_lock);
-
     memset(kpage+page_read_bytes,0,page_zero_bytes);
 
     if(!install_page(upage,kpage,writable))
@@ -90,30 +90,75 @@ spt_load_file(struct spt_entry *spte)
     }
 
     spte->is_present=true;
+    frame_loaded(kpage);
     return true;
 }
 
+/* Gives the current process's page in swap SLOT, if any, a free
+   frame for read-around and maps it there, storing the frame in
+   *FRAME.  Returns the page, or NULL. */
+static struct spt_entry *
+spt_readahead(size_t slot, void **frame)
+{
+    struct spt_entry *spte=swap_slot_owner(slot);
+    if(spte==NULL)
+        return NULL;
+    *frame=frame_get_readahead(spte);
+    if(*frame==NULL)
+        return NULL;
+    if(!install_page(spte->addr,*frame,spte->writeable))
+    {
+        frame_free(*frame);
+        return NULL;
+    }
+    return spte;
+}
+
+/* Loads SPTE's page from swap.  Pages of the same process in the
+   slots around it, within its aligned cluster of SWAP_CLUSTER
+   slots, are read too, in the same read, as far as they are
+   contiguous and free frames are at hand: pages evicted together
+   are likely to be used together again. */
 static bool
 spt_load_swap(struct spt_entry *spte)
 {
+    struct spt_entry *pages[SWAP_CLUSTER];
+    void *frames[SWAP_CLUSTER];
+    size_t base=spte->swap_index - spte->swap_index % SWAP_CLUSTER;
+    size_t lo=spte->swap_index - base, hi=lo;
+    size_t i;
+
     uint8_t *frame=frame_get(spte,false);
-    if(frame!=NULL)
+    if(frame==NULL)
+        return false;
+    if(!install_page(spte->addr,frame,spte->writeable))
     {
-        if(install_page(spte->addr,frame,spte->writeable))
-        {
-            swap_load(spte);
-            spte->is_present = true;
-            return true;
-        }
+        frame_free(frame);
+        return false;
     }
-    frame_free(frame);
-    return false;
+    pages[lo]=spte;
+    frames[lo]=frame;
+
+    while(lo>0 && (pages[lo-1]=spt_readahead(base+lo-1,&frames[lo-1]))!=NULL)
+        lo--;
+    while(hi+1<SWAP_CLUSTER
+          && (pages[hi+1]=spt_readahead(base+hi+1,&frames[hi+1]))!=NULL)
+        hi++;
+
+    swap_read(base+lo,frames+lo,hi-lo+1);
+    for(i=lo;i<=hi;i++)
+    {
+        pages[i]->is_present=true;
+        frame_loaded(frames[i]);
+    }
+    return true;
 }
 
 bool
 spt_load(struct spt_entry *spte)
 {
     spte->pinned=true;
+    frame_wait(spte);
     if(spte->is_present) return true;
     switch(spte->type)
     {
@@ -144,6 +189,7 @@ spt_stack_growth (void *addr)
     spte->pinned=true;
     spte->writeable=true;
     spte->is_present=true;
+    spte->frame=NULL;
 
     uint8_t *frame_addr=frame_get(spte,false);
 
@@ -152,12 +198,15 @@ spt_stack_growth (void *addr)
         if(install_page(spte->addr,frame_addr,spte->writeable))
         {
             if(hash_insert(&thread_current ()->spt, &spte->elem) == NULL)
+            {
+                frame_loaded(frame_addr);
                 return true;
+            }
         }
     }
 
-    free(spte);
     frame_free(frame_addr);
+    free(spte);
     return false;
 }
 
@@ -165,6 +214,7 @@ void
 spt_remove(struct spt_entry *spte)
 {
     hash_delete(&thread_current ()->spt,&spte->elem);
+    frame_forget(spte);
     free(spte);
 }
 
@@ -175,6 +225,7 @@ spt_link_elf(struct file *file, off_t ofs, uint8_t *upage,
     struct spt_entry *spte=malloc(sizeof(struct spt_entry));
     spte->type = PAGE_ELF;
     spte->addr = upage;
+    spte->frame = NULL;
     spte->pinned = false;
     spte->writeable = writable;
     spte->is_present = false;
@@ -192,6 +243,7 @@ spt_link_mmap(struct file *file, off_t ofs, uint8_t *upage,
     struct spt_entry *spte=malloc(sizeof (struct spt_entry));
     spte->type = PAGE_MMAP;
     spte->addr = upage;
+    spte->frame = NULL;
     spte->pinned = false;
     spte->writeable = writable;
     spte->is_present = false;
@@ -47,12 +47,11 @@ struct spt_entry
     uint32_t zero_bytes;
 
     uint32_t swap_index;
+    struct frame_entry *frame;  /* Frame while present or being evicted. */
 
     struct hash_elem elem;
 };
 
-extern struct lock filesystem_lock;
-
 void spt_init(struct hash *spt);
 void spt_clear(struct hash *spt);
 
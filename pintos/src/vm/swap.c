@@ -8,6 +8,21 @@
 #include <devices/block.h>
 #include <stdio.h>
 
+/* Page in each slot, or NULL if the slot is free.  Protected by
+   swap_lock. */
+static struct spt_entry **swap_owner;
+
+/* Slot after the last cluster allocated.  Allocation goes on from
+   here, so pages evicted one after another land in consecutive
+   slots. */
+static size_t swap_cursor;
+
+/* Statistics. */
+static long long swap_out_cnt;  /* Pages written. */
+static long long swap_write_cnt; /* Writes, one per cluster. */
+static long long swap_in_cnt;   /* Pages read. */
+static long long swap_read_cnt; /* Reads. */
+
 void
 swap_init ()
 {
@@ -17,41 +32,141 @@ swap_init ()
 
     swap_map=bitmap_create(block_size (swap_block_device) / SECTOR_PER_PAGE);
     bitmap_set_all(swap_map, 0);
+    swap_owner=calloc(bitmap_size (swap_map), sizeof *swap_owner);
+    if(swap_owner == NULL && bitmap_size (swap_map) > 0)
+        PANIC("swap slot table allocation failed");
 }
 
+/* Allocates CNT consecutive free slots, looking first from the
+   cursor onward, and returns the first, or BITMAP_ERROR if there
+   is no such run.  Must be called with swap_lock held. */
+static size_t
+slot_alloc (size_t cnt)
+{
+    size_t slot = bitmap_scan_and_flip(swap_map, swap_cursor, cnt, 0);
+    if(slot == BITMAP_ERROR)
+        slot = bitmap_scan_and_flip(swap_map, 0, cnt, 0);
+    if(slot != BITMAP_ERROR)
+        swap_cursor = (slot + cnt) % bitmap_size (swap_map);
+    return slot;
+}
+
+/* Writes the CNT pages in FRAMES, at most SWAP_CLUSTER, to swap
+   and stores each page's slot in its entry in SPTES.  The pages
+   go to consecutive slots, in one write, if there is a run of CNT
+   free slots. */
 void
-swap_load(struct spt_entry *spte)
+swap_dump_cluster (void **frames, struct spt_entry **sptes, size_t cnt)
 {
-    lock_acquire(&swap_lock);
+    struct block_iovec iov[SWAP_CLUSTER];
+    size_t first, i;
 
-    if(bitmap_test(swap_map,spte->swap_index)!=0)
+    ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+
+    lock_acquire(&swap_lock);
+    first=slot_alloc(cnt);
+    if(first != BITMAP_ERROR)
     {
-        bitmap_set(swap_map,spte->swap_index,0);
-        for(size_t i = 0; i < SECTOR_PER_PAGE; i++)
-            block_read(swap_block_device, spte->swap_index * SECTOR_PER_PAGE + i, spte->addr + BLOCK_SECTOR_SIZE * i);
+        for(i = 0; i < cnt; i++)
+        {
+            swap_owner[first + i]=sptes[i];
+            sptes[i]->swap_index=first + i;
+            iov[i].base=frames[i];
+            iov[i].cnt=SECTOR_PER_PAGE;
+        }
+        swap_write_cnt++;
+        swap_out_cnt+=cnt;
         lock_release(&swap_lock);
+
+        /* The slots are ours, so others may use swap meanwhile. */
+        block_write_multi(swap_block_device, first * SECTOR_PER_PAGE, iov, cnt);
+        return;
     }
-    else
+
+    /* Swap is too fragmented for a cluster: one page at a time. */
+    for(i = 0; i < cnt; i++)
     {
-        PANIC ("Swap block is free");
+        size_t slot=slot_alloc(1);
+        if(slot == BITMAP_ERROR)
+            PANIC("Swap device is full");
+        swap_owner[slot]=sptes[i];
+        sptes[i]->swap_index=slot;
+    }
+    swap_write_cnt+=cnt;
+    swap_out_cnt+=cnt;
+    lock_release(&swap_lock);
+
+    for(i = 0; i < cnt; i++)
+    {
+        iov[0].base=frames[i];
+        iov[0].cnt=SECTOR_PER_PAGE;
+        block_write_multi(swap_block_device,
+                          sptes[i]->swap_index * SECTOR_PER_PAGE, iov, 1);
     }
 }
 
-size_t
-swap_dump (void *frame)
+/* Returns the page in SLOT if it belongs to the current process,
+   otherwise NULL. */
+struct spt_entry *
+swap_slot_owner (size_t slot)
 {
+    struct spt_entry *spte;
+
+    if(slot >= bitmap_size (swap_map))
+        return NULL;
     lock_acquire(&swap_lock);
-    size_t free_index=bitmap_scan_and_flip(swap_map, 0, 1, 0);
-    if(free_index == BITMAP_ERROR)
+    spte=swap_owner[slot];
+    if(spte != NULL && get_spte(spte->addr) != spte)
+        spte=NULL;
+    lock_release(&swap_lock);
+    return spte;
+}
+
+/* Reads the CNT pages in consecutive slots starting at SLOT into
+   FRAMES, in one read, and frees the slots. */
+void
+swap_read (size_t slot, void **frames, size_t cnt)
+{
+    struct block_iovec iov[SWAP_CLUSTER];
+    size_t i;
+
+    ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER);
+    for(i = 0; i < cnt; i++)
     {
-        PANIC("Swap device is full");
+        iov[i].base=frames[i];
+        iov[i].cnt=SECTOR_PER_PAGE;
     }
-    else
-    {
-        for(size_t i = 0;i < SECTOR_PER_PAGE;i++)
-            block_write(swap_block_device, free_index * SECTOR_PER_PAGE + i, frame + BLOCK_SECTOR_SIZE * i);
+    block_read_multi(swap_block_device, slot * SECTOR_PER_PAGE, iov, cnt);
 
-        lock_release(&swap_lock);
-        return free_index;
-    }
-}
\ No newline at end of file
+    /* Free the slots only now, so that no write reuses them before
+       the read. */
+    lock_acquire(&swap_lock);
+    if(!bitmap_all(swap_map, slot, cnt))
+        PANIC ("Swap block is free");
+    for(i = 0; i < cnt; i++)
+        swap_owner[slot + i]=NULL;
+    bitmap_set_multiple(swap_map, slot, cnt, 0);
+    swap_read_cnt++;
+    swap_in_cnt+=cnt;
+    lock_release(&swap_lock);
+}
+
+/* Frees SLOT, whose page is being discarded. */
+void
+swap_free (size_t slot)
+{
+    lock_acquire(&swap_lock);
+    ASSERT (bitmap_test (swap_map, slot));
+    swap_owner[slot]=NULL;
+    bitmap_reset(swap_map, slot);
+    lock_release(&swap_lock);
+}
+
+/* Prints swap statistics. */
+void
+swap_print_stats (void)
+{
+    printf ("Swap: %lld pages out in %lld writes, "
+            "%lld pages in in %lld reads\n",
+            swap_out_cnt, swap_write_cnt, swap_in_cnt, swap_read_cnt);
+}
@@ -8,13 +8,20 @@
 
 #define SECTOR_PER_PAGE (PGSIZE / BLOCK_SECTOR_SIZE)
 
+/* Pages written to swap together, and slots read together on a
+   swap-in fault. */
+#define SWAP_CLUSTER 8
+
 struct lock swap_lock;
 struct bitmap *swap_map;
 struct block *swap_block_device;
 
 void swap_init (void);
-void swap_load (struct spt_entry *spte);
-size_t swap_dump (void *);
+void swap_dump_cluster (void **frames, struct spt_entry **, size_t cnt);
+struct spt_entry *swap_slot_owner (size_t slot);
+void swap_read (size_t slot, void **frames, size_t cnt);
+void swap_free (size_t slot);
+void swap_print_stats (void);
 
 
-#endif
\ No newline at end of file
+#endif